@@ -0,0 +1,98 @@
+// This file is part of Snownews - A lightweight console RSS newsreader
+//
+// Copyright (c) 2021 Mike Sharov <msharov@users.sourceforge.net>
+//
+// Snownews is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 3
+// as published by the Free Software Foundation.
+//
+// Snownews is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Snownews. If not, see http://www.gnu.org/licenses/.
+
+#include "arena.h"
+#include <stdalign.h>
+#include <stddef.h>
+
+enum { ARENA_BLOCK_SIZE = 32*1024 - 64 };
+
+struct arena_block {
+    struct arena_block* next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) char data[];
+};
+
+struct arena {
+    struct arena_block* blocks;	// The first block is the one being filled
+};
+
+struct arena* NewArena (void)
+{
+    return calloc (1, sizeof (struct arena));
+}
+
+void FreeArena (struct arena* a)
+{
+    if (!a)
+	return;
+    while (a->blocks) {
+	struct arena_block* next = a->blocks->next;
+	free (a->blocks);
+	a->blocks = next;
+    }
+    free (a);
+}
+
+static void* arena_alloc (struct arena* a, size_t sz, size_t align)
+{
+    struct arena_block* b = a->blocks;
+    size_t offset = b ? (b->used + align-1) & ~(align-1) : 0;
+    if (!b || offset > b->size || b->size - offset < sz) {
+	// Large allocations, like long descriptions, get a block of their
+	// own behind the current one, so the rest of it is not wasted.
+	size_t blocksz = sz > ARENA_BLOCK_SIZE/4 ? sz : ARENA_BLOCK_SIZE;
+	struct arena_block* nb = malloc (sizeof (struct arena_block) + blocksz);
+	if (!nb)
+	    return NULL;
+	nb->size = blocksz;
+	nb->used = 0;
+	if (b && blocksz == sz) {
+	    nb->next = b->next;
+	    b->next = nb;
+	} else {
+	    nb->next = b;
+	    a->blocks = nb;
+	}
+	b = nb;
+	offset = 0;
+    }
+    b->used = offset + sz;
+    return &b->data[offset];
+}
+
+// Returns memory aligned for any type, like malloc
+void* ArenaAlloc (struct arena* a, size_t sz)
+{
+    return arena_alloc (a, sz, alignof(max_align_t));
+}
+
+char* ArenaStrndup (struct arena* a, const char* s, size_t n)
+{
+    n = strnlen (s, n);
+    char* d = arena_alloc (a, n + 1, 1);
+    if (d) {
+	memcpy (d, s, n);
+	d[n] = 0;
+    }
+    return d;
+}
+
+char* ArenaStrdup (struct arena* a, const char* s)
+{
+    return ArenaStrndup (a, s, SIZE_MAX);
+}
@@ -0,0 +1,28 @@
+// This file is part of Snownews - A lightweight console RSS newsreader
+//
+// Copyright (c) 2021 Mike Sharov <msharov@users.sourceforge.net>
+//
+// Snownews is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 3
+// as published by the Free Software Foundation.
+//
+// Snownews is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Snownews. If not, see http://www.gnu.org/licenses/.
+
+#pragma once
+#include "main.h"
+
+// Bump allocator for the items of one feed parse.
+// Allocations are not freed individually; FreeArena frees them all.
+struct arena;
+
+struct arena* NewArena (void);
+void FreeArena (struct arena* a);
+void* ArenaAlloc (struct arena* a, size_t sz);
+char* ArenaStrndup (struct arena* a, const char* s, size_t n);
+char* ArenaStrdup (struct arena* a, const char* s);
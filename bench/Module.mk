@@ -0,0 +1,47 @@
+################ Source files ##########################################
+
+bench/srcs	:= $(wildcard bench/*.c)
+bench/objs	:= $(addprefix $O,$(bench/srcs:.c=.o))
+bench/deps	:= ${bench/objs:.o=.d}
+bench/replay	:= $Obench/replay
+# Benchmarks linked with the snownews objects, main.c replaced by stubs
+bench/linked	:= $(addprefix $Obench/,restore pump dispatch)
+bench/linkobjs	:= $(filter-out $Omain.o,${objs}) $Obench/stubs.o
+bench/micro	:= ${bench/linked} $Obench/spawn
+
+# Options for the replay server in the refresh benchmark
+BENCH_REPLAY	?= -n 100 -i 50 -l 20 -j 40
+
+################ Compilation ###########################################
+
+.PHONY:	bench bench/all bench/refresh bench/micro bench/clean
+
+bench/all:	${bench/replay} ${bench/micro}
+
+bench:	bench/refresh bench/micro
+bench/micro:	${bench/micro}
+	@for b in ${bench/micro}; do echo "$$(basename $$b):"; $$b || exit; done
+bench/refresh:	${exe} ${bench/replay}
+	@echo "Refresh from the replay server:"
+	@bench/refresh.sh ${exe} ${bench/replay} ${BENCH_REPLAY}
+
+${bench/replay} $Obench/spawn:	$Obench/%:	$Obench/%.o
+	@echo "Linking $@ ..."
+	@${CC} ${ldflags} -o $@ $^
+
+${bench/linked}:	$Obench/%:	$Obench/%.o ${bench/linkobjs}
+	@echo "Linking $@ ..."
+	@${CC} ${ldflags} -o $@ $^ ${libs}
+
+################ Maintenance ###########################################
+
+clean:	bench/clean
+bench/clean:
+	@if [ -d ${builddir}/bench ]; then\
+	    rm -f ${bench/replay} ${bench/micro} ${bench/objs} ${bench/deps} $Obench/.d;\
+	    rmdir ${builddir}/bench;\
+	fi
+
+${bench/objs}: Makefile bench/Module.mk ${confs} | $Obench/.d
+
+-include ${bench/deps}
@@ -0,0 +1,89 @@
+// This file is part of Snownews - A lightweight console RSS newsreader
+//
+// Copyright (c) 2021 Mike Sharov <msharov@users.sourceforge.net>
+//
+// Snownews is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 3
+// as published by the Free Software Foundation.
+//
+// Snownews is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Snownews. If not, see http://www.gnu.org/licenses/.
+
+
+// Benchmark of the feed parser element dispatch, parsing a 5000 item
+// RSS feed using the dc, content and sy namespaces into a new feed each
+// time, so that no read status is restored.
+//
+// Usage: dispatch [items]
+
+#include "../parse.h"
+#include "../feedio.h"
+#include "../arena.h"
+#include <time.h>
+
+enum { NRUNS = 100 };
+
+static char* make_feed (unsigned nitems, unsigned* size)
+{
+    size_t cap = 512 + nitems * 512;
+    char* b = malloc (cap);
+    int n = snprintf (b, cap, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		      "<rss version=\"2.0\" xmlns:dc=\"http://purl.org/dc/elements/1.1/\""
+		      " xmlns:content=\"http://purl.org/rss/1.0/modules/content/\""
+		      " xmlns:sy=\"http://purl.org/rss/1.0/modules/syndication/\">\n"
+		      "<channel><title>Dispatch</title><link>http://example.com/</link><description>Bench</description>"
+		      "<sy:updatePeriod>hourly</sy:updatePeriod><sy:updateFrequency>2</sy:updateFrequency>\n");
+    for (unsigned i = 0; i < nitems; ++i)
+	n += snprintf (b + n, cap - n, "<item><title>Item %u</title><link>http://example.com/%u</link>"
+		       "<description>Description of item %u</description><content:encoded><![CDATA[<p>body %u</p>]]></content:encoded>"
+		       "<dc:creator>Author %u</dc:creator><dc:date>2024-01-%02uT%02u:00:00Z</dc:date>"
+		       "<guid>item-%u</guid><category>Bench</category></item>\n",
+		       i, i, i, i, i % 10, 1 + i % 28, i % 24, i);
+    n += snprintf (b + n, cap - n, "</channel></rss>\n");
+    *size = n;
+    return b;
+}
+
+static int compare_doubles (const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+int main (int argc, char* argv[])
+{
+    unsigned nitems = argc > 1 ? (unsigned) atoi (argv[1]) : 5000, size;
+    char* text = make_feed (nitems, &size);
+    double times [NRUNS];
+    unsigned nparsed = 0;
+    for (unsigned r = 0; r < NRUNS; ++r) {
+	struct feed* fp = newFeedStruct();
+	fp->feedurl = strdup ("bench:dispatch");
+	fp->xmltext = text;
+	fp->content_length = size;
+	struct timespec t0, t1;
+	clock_gettime (CLOCK_MONOTONIC, &t0);
+	DeXML (fp);
+	clock_gettime (CLOCK_MONOTONIC, &t1);
+	times[r] = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+	nparsed = 0;
+	for (const struct newsitem* i = fp->items; i; i = i->next)
+	    nparsed += i->data->description && i->data->date;
+	FreeArena (fp->itemarena);
+	free (fp->title);
+	free (fp->link);
+	free (fp->description);
+	free (fp->feedurl);
+	free (fp);
+    }
+    qsort (times, NRUNS, sizeof (double), compare_doubles);
+    printf ("# items\tkb\tmedian_ms\tmin_ms\tparsed\n");
+    printf ("%u\t%u\t%.2f\t%.2f\t%u\n", nitems, size / 1024, times[NRUNS/2], times[0], nparsed);
+    free (text);
+    return EXIT_SUCCESS;
+}
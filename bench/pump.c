@@ -0,0 +1,98 @@
+// This file is part of Snownews - A lightweight console RSS newsreader
+//
+// Copyright (c) 2021 Mike Sharov <msharov@users.sourceforge.net>
+//
+// Snownews is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 3
+// as published by the Free Software Foundation.
+//
+// Snownews is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Snownews. If not, see http://www.gnu.org/licenses/.
+
+
+// Benchmark of the filter pump, pushing a large feed through cat, both
+// as a plain filter and as a co-process, and checking that all of it
+// comes back.
+//
+// Usage: pump [megabytes]
+
+#include "../feedio.h"
+#include "../filters.h"
+#include "../rxbuf.h"
+#include <time.h>
+
+enum { NRUNS = 6 };
+
+static char* make_feed (unsigned size)
+{
+    char* b = malloc (size + 1);
+    if (!b)
+	return NULL;
+    unsigned n = snprintf (b, size, "<?xml version=\"1.0\"?>\n<rss version=\"2.0\"><channel><title>Pump</title>\n");
+    for (unsigned i = 0; n + 256 < size; ++i)
+	n += snprintf (b + n, size - n, "<item><title>Item %u</title><link>http://example.com/%u</link>"
+		       "<description>Description of item %u, long enough to make it a realistic size</description></item>\n", i, i, i);
+    n += snprintf (b + n, size - n, "</channel></rss>\n");
+    memset (b + n, ' ', size - n);
+    return b;
+}
+
+static int compare_doubles (const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+// Returns the median time to filter text, or a negative value on error
+static double pump_ms (const char* filter, const char* text, unsigned size)
+{
+    struct feed* fp = newFeedStruct();
+    fp->feedurl = strdup ("bench:pump");
+    fp->perfeedfilter = strdup (filter);
+    double times [NRUNS];
+    for (unsigned r = 0; r < NRUNS; ++r) {
+	// The input is handed over to the filter, so a new copy each time
+	if (!RxBufReserve (&fp->xmltext, &fp->xmlcapacity, 0, size + 1))
+	    return -1;
+	memcpy (fp->xmltext, text, size);
+	fp->content_length = size;
+
+	struct timespec t0, t1;
+	clock_gettime (CLOCK_MONOTONIC, &t0);
+	int rc = FilterPipeNG (fp);
+	clock_gettime (CLOCK_MONOTONIC, &t1);
+	times[r] = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+
+	if (rc < 0 || fp->content_length != size || 0 != memcmp (fp->xmltext, text, size)) {
+	    fprintf (stderr, "%s: output differs from input\n", filter);
+	    return -1;
+	}
+    }
+    RxBufRelease (&fp->xmltext, &fp->xmlcapacity);
+    qsort (times, NRUNS, sizeof (double), compare_doubles);
+    return times[NRUNS/2];
+}
+
+int main (int argc, char* argv[])
+{
+    unsigned mb = argc > 1 ? (unsigned) atoi (argv[1]) : 50;
+    unsigned size = mb * 1024 * 1024;
+    char* text = make_feed (size);
+    if (!text)
+	return EXIT_FAILURE;
+    printf ("# filter\tmb\tmedian_ms\tmb_per_s\n");
+    static const char* const c_filters[] = { "cat", "coproc:cat" };
+    for (unsigned f = 0; f < sizeof (c_filters) / sizeof (c_filters[0]); ++f) {
+	double ms = pump_ms (c_filters[f], text, size);
+	if (ms < 0)
+	    return EXIT_FAILURE;
+	printf ("%s\t%u\t%.1f\t%.0f\n", c_filters[f], mb, ms, mb * 1000 / ms);
+    }
+    free (text);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# End-to-end refresh benchmark. Starts the replay server, subscribes a
+# scratch home directory to all its feeds, and refreshes them twice with
+# snownews --refresh-only: first with every feed new, then with the
+# conditional requests the cache allows. Prints the summary lines.
+#
+# Usage: refresh.sh snownews replay [replay options]
+# Set BENCH_FILTER to a filter command to pipe every feed through it.
+
+[ $# -ge 2 ] || { echo "Usage: $0 snownews replay [replay options]" >&2; exit 1; }
+snownews=$1
+replay=$2
+shift 2
+
+home=$(mktemp -d "${TMPDIR:-/tmp}/snowbench.XXXXXX") || exit 1
+mkdir -p "$home/.config/snownews" "$home/.local/share"
+trap 'kill $server 2>/dev/null; wait $server 2>/dev/null; rm -rf "$home"' EXIT INT TERM
+
+"$replay" -u "$home/feeds" "$@" > "$home/port" &
+server=$!
+while [ ! -s "$home/port" ]; do
+    kill -0 $server 2>/dev/null || exit 1
+    sleep 0.1
+done
+
+# Old style subscription list: url|name|categories|filter
+sed "s/\$/|||${BENCH_FILTER}/" "$home/feeds" > "$home/.config/snownews/urls"
+printf "parallel downloads:8\nconnections per host:0\n" > "$home/.config/snownews/network"
+
+for run in new cached; do
+    echo "# $run"
+    HOME=$home "$snownews" --update --refresh-only 2>/dev/null | grep '^# [a-z_/]*='
+done
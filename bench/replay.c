@@ -0,0 +1,468 @@
+// This file is part of Snownews - A lightweight console RSS newsreader
+//
+// Copyright (c) 2021 Mike Sharov <msharov@users.sourceforge.net>
+//
+// Snownews is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 3
+// as published by the Free Software Foundation.
+//
+// Snownews is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Snownews. If not, see http://www.gnu.org/licenses/.
+
+// Local HTTP stand-in for feed servers, to benchmark refreshes without
+// the network. Serves either the files in a directory, such as recorded
+// feeds, or a synthetic corpus of RSS 1.0, RSS 2.0 and Atom feeds, with
+// configurable latency, bandwidth, 304 replies and errors.
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+//{{{ Settings ---------------------------------------------------------
+
+static struct {
+    unsigned	port;
+    const char*	dir;		// Serve files from here, if set
+    const char*	urlfile;	// Write the feed URLs here
+    unsigned	nfeeds;		// Synthetic feeds of each format
+    unsigned	nitems;		// Items in each synthetic feed
+    unsigned	latency;	// ms before each reply
+    unsigned	jitter;		// Up to this many ms more
+    unsigned	bandwidth;	// KB/s for each connection, 0 for unlimited
+    unsigned	notmodified;	// Percent of conditional requests given 304
+    unsigned	errors;		// Percent of requests failed with 503
+    uint64_t	seed;
+} s_opt = {
+    .nfeeds = 20,
+    .nitems = 30,
+    .notmodified = 100,
+    .seed = 1
+};
+
+static void usage (void)
+{
+    printf ("Usage: replay [options]\n\n"
+	    "\t-p port\t\tListen on port, 0 (default) for any\n"
+	    "\t-d dir\t\tServe the files in dir instead of a synthetic corpus\n"
+	    "\t-u file\t\tWrite the URL of each feed to file\n"
+	    "\t-n feeds\tSynthetic feeds of each format (%u)\n"
+	    "\t-i items\tItems in each synthetic feed (%u)\n"
+	    "\t-l ms\t\tLatency before each reply\n"
+	    "\t-j ms\t\tRandom extra latency, up to this\n"
+	    "\t-b KB/s\t\tBandwidth of each connection, 0 for unlimited\n"
+	    "\t-m percent\tConditional requests answered 304 (%u)\n"
+	    "\t-e percent\tRequests failed with 503\n"
+	    "\t-s seed\t\tSeed for latency and error choices\n",
+	    s_opt.nfeeds, s_opt.nitems, s_opt.notmodified);
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Corpus -----------------------------------------------------------
+
+struct doc {
+    char*	path;
+    char*	body;
+    size_t	size;
+    char	etag [24];
+};
+
+static struct doc* s_docs = NULL;
+static unsigned s_ndocs = 0;
+static char s_lastmodified [64] = "";
+
+// Appends printf output to the growing buffer at *pbuf
+static void bufprintf (char** pbuf, size_t* size, size_t* cap, const char* fmt, ...)
+    __attribute__((format(printf,4,5)));
+static void bufprintf (char** pbuf, size_t* size, size_t* cap, const char* fmt, ...)
+{
+    for (;;) {
+	va_list args;
+	va_start (args, fmt);
+	int n = vsnprintf (*pbuf + *size, *cap - *size, fmt, args);
+	va_end (args);
+	if (n < 0)
+	    exit (EXIT_FAILURE);
+	if (*size + n < *cap) {
+	    *size += n;
+	    return;
+	}
+	*cap = (*cap + n) * 2;
+	if (!(*pbuf = realloc (*pbuf, *cap)))
+	    exit (EXIT_FAILURE);
+    }
+}
+
+static struct doc* add_doc (const char* path, char* body, size_t size)
+{
+    struct doc* d = realloc (s_docs, (s_ndocs + 1) * sizeof (struct doc));
+    if (!d)
+	exit (EXIT_FAILURE);
+    s_docs = d;
+    d = &s_docs[s_ndocs++];
+    d->path = strdup (path);
+    d->body = body;
+    d->size = size;
+    // FNV-1a of the body
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i)
+	h = (h ^ (unsigned char) body[i]) * 1099511628211ull;
+    snprintf (d->etag, sizeof (d->etag), "\"%016llx\"", (unsigned long long) h);
+    return d;
+}
+
+enum EFormat { format_rss1, format_rss2, format_atom, format_count };
+static const char* const c_format_names [format_count] = { "rss1", "rss2", "atom" };
+
+static void make_feed (enum EFormat fmt, unsigned n)
+{
+    char* b = NULL;
+    size_t size = 0, cap = 0;
+    bufprintf (&b, &size, &cap, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    if (fmt == format_rss1)
+	bufprintf (&b, &size, &cap, "<rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\""
+		" xmlns=\"http://purl.org/rss/1.0/\" xmlns:dc=\"http://purl.org/dc/elements/1.1/\">\n"
+		"<channel><title>RSS 1.0 feed %u</title><link>http://example.com/rss1/%u</link>"
+		"<description>Synthetic feed</description></channel>\n", n, n);
+    else if (fmt == format_rss2)
+	bufprintf (&b, &size, &cap, "<rss version=\"2.0\" xmlns:content=\"http://purl.org/rss/1.0/modules/content/\">\n"
+		"<channel><title>RSS 2.0 feed %u</title><link>http://example.com/rss2/%u</link>"
+		"<description>Synthetic feed</description><ttl>60</ttl>\n", n, n);
+    else
+	bufprintf (&b, &size, &cap, "<feed xmlns=\"http://www.w3.org/2005/Atom\">\n"
+		"<title>Atom feed %u</title><link href=\"http://example.com/atom/%u\"/>"
+		"<id>urn:feed:%u</id><updated>2024-01-01T00:00:00Z</updated>\n", n, n, n);
+
+    for (unsigned i = 0; i < s_opt.nitems; ++i) {
+	const char* f = c_format_names[fmt];
+	unsigned day = 1 + i % 28, hour = i % 24;
+	if (fmt == format_rss1)
+	    bufprintf (&b, &size, &cap, "<item rdf:about=\"http://example.com/%s/%u/%u\"><title>Item %u of feed %u</title>"
+		    "<link>http://example.com/%s/%u/%u</link><description>Description of item %u, with &lt;b&gt;some&lt;/b&gt; markup.</description>"
+		    "<dc:date>2024-01-%02uT%02u:00:00Z</dc:date></item>\n", f, n, i, i, n, f, n, i, i, day, hour);
+	else if (fmt == format_rss2)
+	    bufprintf (&b, &size, &cap, "<item><title>Item %u of feed %u</title><link>http://example.com/%s/%u/%u</link>"
+		    "<description>Description of item %u.</description><content:encoded><![CDATA[<p>Content of item %u</p>]]></content:encoded>"
+		    "<guid>%s-%u-%u</guid><pubDate>Mon, %02u Jan 2024 %02u:00:00 +0000</pubDate></item>\n",
+		    i, n, f, n, i, i, i, f, n, i, day, hour);
+	else
+	    bufprintf (&b, &size, &cap, "<entry><title>Item %u of feed %u</title><link href=\"http://example.com/%s/%u/%u\"/>"
+		    "<id>urn:%s:%u:%u</id><updated>2024-01-%02uT%02u:00:00Z</updated>"
+		    "<summary>Summary of item %u.</summary><content type=\"html\">&lt;p&gt;Content of item %u&lt;/p&gt;</content></entry>\n",
+		    i, n, f, n, i, f, n, i, day, hour, i, i);
+    }
+    bufprintf (&b, &size, &cap, fmt == format_rss1 ? "</rdf:RDF>\n" : fmt == format_rss2 ? "</channel></rss>\n" : "</feed>\n");
+
+    char path [64];
+    snprintf (path, sizeof (path), "/%s/%u.xml", c_format_names[fmt], n);
+    add_doc (path, b, size);
+}
+
+static void load_dir (const char* dirname)
+{
+    DIR* dir = opendir (dirname);
+    if (!dir) {
+	perror (dirname);
+	exit (EXIT_FAILURE);
+    }
+    for (struct dirent* de; (de = readdir (dir));) {
+	char filename [PATH_MAX];
+	snprintf (filename, sizeof (filename), "%s/%s", dirname, de->d_name);
+	struct stat st;
+	FILE* fp;
+	if (de->d_name[0] == '.' || 0 != stat (filename, &st) || !S_ISREG (st.st_mode) || !(fp = fopen (filename, "r")))
+	    continue;
+	char* body = malloc (st.st_size + 1);
+	size_t br = body ? fread (body, 1, st.st_size, fp) : 0;
+	fclose (fp);
+	char path [PATH_MAX];
+	snprintf (path, sizeof (path), "/%s", de->d_name);
+	add_doc (path, body, br);
+    }
+    closedir (dir);
+}
+
+static int compare_docs (const void* a, const void* b)
+{
+    return strcmp (((const struct doc*) a)->path, ((const struct doc*) b)->path);
+}
+
+static void load_corpus (void)
+{
+    if (s_opt.dir)
+	load_dir (s_opt.dir);
+    else {
+	for (unsigned n = 0; n < s_opt.nfeeds; ++n)
+	    for (enum EFormat f = 0; f < format_count; ++f)
+		make_feed (f, n);
+    }
+    qsort (s_docs, s_ndocs, sizeof (struct doc), compare_docs);
+    time_t now = time (NULL);
+    struct tm tm;
+    strftime (s_lastmodified, sizeof (s_lastmodified), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r (&now, &tm));
+}
+
+static const struct doc* find_doc (const char* path)
+{
+    struct doc key = { .path = (char*) path };
+    return bsearch (&key, s_docs, s_ndocs, sizeof (struct doc), compare_docs);
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Statistics -----------------------------------------------------
+
+static atomic_uint_fast64_t s_nrequests = 0;
+static atomic_uint s_nok = 0, s_nnotmodified = 0, s_nfailed = 0, s_nmissing = 0;
+static atomic_uint_fast64_t s_nbytes = 0;
+
+// Pseudorandom number, reproducible for a given seed and request order
+static uint64_t next_random (void)
+{
+    uint64_t z = s_opt.seed + 0x9e3779b97f4a7c15ull * (atomic_fetch_add (&s_nrequests, 1) + 1);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static void print_stats (void)
+{
+    fprintf (stderr, "# replay requests=%u ok=%u not_modified=%u failed=%u missing=%u sent_kb=%llu\n",
+	     s_nok + s_nnotmodified + s_nfailed + s_nmissing, s_nok, s_nnotmodified, s_nfailed, s_nmissing,
+	     (unsigned long long) s_nbytes / 1024);
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Connections ----------------------------------------------------
+
+static void sleep_ms (unsigned ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000l };
+    while (0 != nanosleep (&ts, &ts) && errno == EINTR) {}
+}
+
+static uint64_t now_ms (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+// Sends data, throttled to the configured bandwidth
+static bool send_all (int fd, const char* data, size_t size)
+{
+    size_t slice = s_opt.bandwidth ? s_opt.bandwidth * 1024 / 20 + 1 : size;
+    uint64_t start = now_ms();
+    for (size_t sent = 0; sent < size;) {
+	size_t n = size - sent < slice ? size - sent : slice;
+	ssize_t bw = send (fd, data + sent, n, MSG_NOSIGNAL);
+	if (bw < 0 && errno == EINTR)
+	    continue;
+	if (bw <= 0)
+	    return false;
+	sent += bw;
+	s_nbytes += bw;
+	if (s_opt.bandwidth) {
+	    uint64_t due = start + sent * 1000 / (s_opt.bandwidth * 1024ull), now = now_ms();
+	    if (due > now)
+		sleep_ms (due - now);
+	}
+    }
+    return true;
+}
+
+// Returns the value of header name in the request, or NULL
+static const char* header_value (const char* req, const char* name, size_t* len)
+{
+    size_t nlen = strlen (name);
+    for (const char* l = strstr (req, "\r\n"); l && l[2] != '\r'; l = strstr (l + 2, "\r\n")) {
+	if (0 != strncasecmp (l + 2, name, nlen) || l[2 + nlen] != ':')
+	    continue;
+	const char* v = l + 2 + nlen + 1;
+	v += strspn (v, " \t");
+	*len = strcspn (v, "\r\n");
+	return v;
+    }
+    return NULL;
+}
+
+static bool header_is (const char* req, const char* name, const char* value)
+{
+    size_t len = 0;
+    const char* v = header_value (req, name, &len);
+    return v && len == strlen (value) && 0 == strncasecmp (v, value, len);
+}
+
+// Replies to one request. Returns false to close the connection.
+static bool serve_request (int fd, char* req)
+{
+    char method [16], path [PATH_MAX], version [16];
+    if (3 != sscanf (req, "%15s %4095s %15s", method, path, version))
+	return false;
+    char* query = strchr (path, '?');
+    if (query)
+	*query = '\0';
+    bool keepalive = 0 == strcmp (version, "HTTP/1.1") ? !header_is (req, "Connection", "close") : header_is (req, "Connection", "keep-alive");
+
+    uint64_t r = next_random();
+    unsigned delay = s_opt.latency + (s_opt.jitter ? (unsigned) (r >> 32) % (s_opt.jitter + 1) : 0);
+    if (delay)
+	sleep_ms (delay);
+
+    const struct doc* d = find_doc (path);
+    size_t inmlen = 0, imslen = 0;
+    const char* inm = header_value (req, "If-None-Match", &inmlen);
+    const char* ims = header_value (req, "If-Modified-Since", &imslen);
+    bool cached = d && ((inm && inmlen == strlen (d->etag) && 0 == strncmp (inm, d->etag, inmlen))
+			|| (!inm && ims && imslen == strlen (s_lastmodified) && 0 == strncmp (ims, s_lastmodified, imslen)));
+
+    char head [512];
+    const char* body = "";
+    size_t bodysize = 0;
+    int hl;
+    if (!d) {
+	++s_nmissing;
+	hl = snprintf (head, sizeof (head), "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+    } else if (r % 100 < s_opt.errors) {
+	++s_nfailed;
+	hl = snprintf (head, sizeof (head), "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+    } else if (cached && (r >> 8) % 100 < s_opt.notmodified) {
+	++s_nnotmodified;
+	hl = snprintf (head, sizeof (head), "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nLast-Modified: %s\r\n\r\n", d->etag, s_lastmodified);
+    } else {
+	++s_nok;
+	body = d->body;
+	bodysize = d->size;
+	hl = snprintf (head, sizeof (head), "HTTP/1.1 200 OK\r\nContent-Type: application/xml\r\nContent-Length: %zu\r\n"
+			"ETag: %s\r\nLast-Modified: %s\r\n\r\n", d->size, d->etag, s_lastmodified);
+    }
+    if (0 == strcmp (method, "HEAD"))
+	bodysize = 0;
+    return send_all (fd, head, hl) && send_all (fd, body, bodysize) && keepalive;
+}
+
+static void* serve_connection (void* arg)
+{
+    int fd = (intptr_t) arg;
+    char req [8192];
+    size_t size = 0;
+    for (;;) {
+	char* end;
+	req[size] = '\0';
+	while (!(end = strstr (req, "\r\n\r\n"))) {
+	    if (size >= sizeof (req) - 1)
+		goto done;
+	    ssize_t br = recv (fd, req + size, sizeof (req) - 1 - size, 0);
+	    if (br < 0 && errno == EINTR)
+		continue;
+	    if (br <= 0)
+		goto done;
+	    size += br;
+	    req[size] = '\0';
+	}
+	end[2] = '\0';	// Keep the last CRLF, which ends the header search
+	size_t reqsize = end + 4 - req;
+	if (!serve_request (fd, req))
+	    break;
+	memmove (req, req + reqsize, size - reqsize);
+	size -= reqsize;
+    }
+done:
+    close (fd);
+    return NULL;
+}
+
+//}}}-------------------------------------------------------------------
+
+static volatile sig_atomic_t s_quit = false;
+
+static void on_quit_signal (int sig __attribute__((unused)))
+{
+    s_quit = true;
+}
+
+int main (int argc, char* argv[])
+{
+    for (int c; 0 < (c = getopt (argc, argv, "p:d:u:n:i:l:j:b:m:e:s:h"));) {
+	switch (c) {
+	    case 'p':	s_opt.port = atoi (optarg); break;
+	    case 'd':	s_opt.dir = optarg; break;
+	    case 'u':	s_opt.urlfile = optarg; break;
+	    case 'n':	s_opt.nfeeds = atoi (optarg); break;
+	    case 'i':	s_opt.nitems = atoi (optarg); break;
+	    case 'l':	s_opt.latency = atoi (optarg); break;
+	    case 'j':	s_opt.jitter = atoi (optarg); break;
+	    case 'b':	s_opt.bandwidth = atoi (optarg); break;
+	    case 'm':	s_opt.notmodified = atoi (optarg); break;
+	    case 'e':	s_opt.errors = atoi (optarg); break;
+	    case 's':	s_opt.seed = strtoull (optarg, NULL, 0); break;
+	    default:	usage(); return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+    }
+    load_corpus();
+
+    int sfd = socket (AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt (sfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons (s_opt.port), .sin_addr.s_addr = htonl (INADDR_LOOPBACK) };
+    socklen_t addrlen = sizeof (addr);
+    if (sfd < 0 || 0 != bind (sfd, (struct sockaddr*) &addr, sizeof (addr)) || 0 != listen (sfd, 128)
+	    || 0 != getsockname (sfd, (struct sockaddr*) &addr, &addrlen)) {
+	perror ("replay");
+	return EXIT_FAILURE;
+    }
+    s_opt.port = ntohs (addr.sin_port);
+
+    if (s_opt.urlfile) {
+	FILE* uf = fopen (s_opt.urlfile, "w");
+	if (!uf) {
+	    perror (s_opt.urlfile);
+	    return EXIT_FAILURE;
+	}
+	for (unsigned i = 0; i < s_ndocs; ++i)
+	    fprintf (uf, "http://127.0.0.1:%u%s\n", s_opt.port, s_docs[i].path);
+	fclose (uf);
+    }
+    printf ("%u\n", s_opt.port);
+    fflush (stdout);
+
+    // Without SA_RESTART, so that accept returns on these
+    struct sigaction sa = { .sa_handler = on_quit_signal };
+    sigaction (SIGINT, &sa, NULL);
+    sigaction (SIGTERM, &sa, NULL);
+    signal (SIGPIPE, SIG_IGN);
+
+    while (!s_quit) {
+	int cfd = accept (sfd, NULL, NULL);
+	if (cfd < 0)
+	    continue;
+	pthread_t t;
+	pthread_attr_t attr;
+	pthread_attr_init (&attr);
+	pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+	if (0 != pthread_create (&t, &attr, serve_connection, (void*)(intptr_t) cfd))
+	    close (cfd);
+	pthread_attr_destroy (&attr);
+    }
+    print_stats();
+    return EXIT_SUCCESS;
+}
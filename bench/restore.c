@@ -0,0 +1,133 @@
+// This file is part of Snownews - A lightweight console RSS newsreader
+//
+// Copyright (c) 2021 Mike Sharov <msharov@users.sourceforge.net>
+//
+// Snownews is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 3
+// as published by the Free Software Foundation.
+//
+// Snownews is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Snownews. If not, see http://www.gnu.org/licenses/.
+
+
+// Benchmark of restoring the read status of items when a feed is
+// reparsed, as on every refresh. Each size is parsed into a new feed,
+// all items are marked read, and the feed is parsed again. The
+// difference between the two parse times is the restore cost. For
+// comparison, the restore is then repeated the way it was done before
+// the hash table, by scanning a list of the old items for each item.
+//
+// Usage: restore [items ...]
+
+#include "../parse.h"
+#include "../feedio.h"
+#include <time.h>
+
+enum { NRUNS = 5 };
+
+static char* make_feed (unsigned nitems, unsigned* size)
+{
+    size_t cap = 256 + nitems * 256;
+    char* b = malloc (cap);
+    int n = snprintf (b, cap, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<rss version=\"2.0\">\n"
+		      "<channel><title>Restore</title><link>http://example.com/</link><description>Bench</description>\n");
+    for (unsigned i = 0; i < nitems; ++i)
+	n += snprintf (b + n, cap - n, "<item><title>Item %u</title><link>http://example.com/%u</link>"
+		       "<description>Description of item %u</description><guid>item-%u</guid></item>\n", i, i, i, i);
+    n += snprintf (b + n, cap - n, "</channel></rss>\n");
+    *size = n;
+    return b;
+}
+
+static double parse_ms (struct feed* fp)
+{
+    struct timespec t0, t1;
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    DeXML (fp);
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+}
+
+// The old restore: copies the read states into a list, then looks
+// up each item with a linear scan of it.
+static double linear_restore_ms (struct feed* fp)
+{
+    struct timespec t0, t1;
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    struct newsitem* oldstatus = NULL;
+    struct newsitem* lastcopy = NULL;
+    for (const struct newsitem* cur_item = fp->items; cur_item; cur_item = cur_item->next) {
+	struct newsitem* copy = calloc (1, sizeof (struct newsitem));
+	copy->data = calloc (1, sizeof (struct newsdata));
+	copy->data->readstatus = cur_item->data->readstatus;
+	copy->data->hash = strdup (cur_item->data->hash ? cur_item->data->hash : "");
+	if (!lastcopy)
+	    oldstatus = copy;
+	else
+	    lastcopy->next = copy;
+	lastcopy = copy;
+    }
+    for (struct newsitem* item = fp->items; item; item = item->next) {
+	for (const struct newsitem* i = oldstatus; i; i = i->next) {
+	    if (strcmp (item->data->hash, i->data->hash) == 0) {
+		item->data->readstatus = i->data->readstatus;
+		break;
+	    }
+	}
+    }
+    while (oldstatus) {
+	struct newsitem* next = oldstatus->next;
+	free (oldstatus->data->hash);
+	free (oldstatus->data);
+	free (oldstatus);
+	oldstatus = next;
+    }
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+}
+
+static int compare_doubles (const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+int main (int argc, char* argv[])
+{
+    static const unsigned c_sizes[] = { 1000, 2000, 5000, 10000 };
+    unsigned nsizes = argc > 1 ? (unsigned) argc - 1 : sizeof (c_sizes) / sizeof (c_sizes[0]);
+    printf ("# items\tparse_ms\treparse_ms\trestore_ms\tlinear_ms\trestored\n");
+    for (unsigned s = 0; s < nsizes; ++s) {
+	unsigned nitems = argc > 1 ? (unsigned) atoi (argv[s+1]) : c_sizes[s];
+	unsigned size;
+	char* text = make_feed (nitems, &size);
+	double parse [NRUNS], reparse [NRUNS], linear [NRUNS];
+	unsigned restored = 0;
+	for (unsigned r = 0; r < NRUNS; ++r) {
+	    struct feed* fp = newFeedStruct();
+	    fp->feedurl = strdup ("bench:restore");
+	    fp->xmltext = text;
+	    fp->content_length = size;
+	    parse[r] = parse_ms (fp);
+	    for (struct newsitem* i = fp->items; i; i = i->next)
+		i->data->readstatus = true;
+	    reparse[r] = parse_ms (fp);
+	    restored = 0;
+	    for (const struct newsitem* i = fp->items; i; i = i->next)
+		restored += i->data->readstatus;
+	    linear[r] = linear_restore_ms (fp);
+	}
+	qsort (parse, NRUNS, sizeof (double), compare_doubles);
+	qsort (reparse, NRUNS, sizeof (double), compare_doubles);
+	qsort (linear, NRUNS, sizeof (double), compare_doubles);
+	printf ("%u\t%.2f\t%.2f\t%.2f\t%.2f\t%u\n", nitems, parse[NRUNS/2], reparse[NRUNS/2],
+		reparse[NRUNS/2] - parse[NRUNS/2], linear[NRUNS/2], restored);
+	free (text);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,90 @@
+// This file is part of Snownews - A lightweight console RSS newsreader
+//
+// Copyright (c) 2021 Mike Sharov <msharov@users.sourceforge.net>
+//
+// Snownews is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 3
+// as published by the Free Software Foundation.
+//
+// Snownews is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Snownews. If not, see http://www.gnu.org/licenses/.
+
+
+// Benchmark of starting a child process as the parent grows, comparing
+// fork and exec, used for filters and exec feeds before, with
+// posix_spawn, used now. The parent touches the given number of
+// megabytes of heap, like a client with many feeds loaded, then starts
+// /bin/true repeatedly each way.
+//
+// Usage: spawn [megabytes ...]
+
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char** environ;
+
+enum { NRUNS = 200 };
+
+static char* const c_argv[] = { "true", NULL };
+
+static void run_fork (void)
+{
+    pid_t pid = fork();
+    if (!pid) {
+	execv ("/bin/true", c_argv);
+	_exit (127);
+    }
+    if (pid > 0)
+	waitpid (pid, NULL, 0);
+}
+
+static void run_spawn (void)
+{
+    pid_t pid;
+    if (0 == posix_spawn (&pid, "/bin/true", NULL, NULL, c_argv, environ))
+	waitpid (pid, NULL, 0);
+}
+
+// Average microseconds for one start and wait
+static double launch_us (void (*run)(void))
+{
+    struct timespec t0, t1;
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    for (unsigned i = 0; i < NRUNS; ++i)
+	run();
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+    return ((t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3) / NRUNS;
+}
+
+int main (int argc, char* argv[])
+{
+    static const unsigned c_sizes[] = { 0, 16, 64, 256 };
+    unsigned nsizes = argc > 1 ? (unsigned) argc - 1 : sizeof (c_sizes) / sizeof (c_sizes[0]);
+    printf ("# heap_mb\trss_mb\tfork_exec_us\tposix_spawn_us\n");
+    for (unsigned s = 0; s < nsizes; ++s) {
+	size_t mb = argc > 1 ? (unsigned) atoi (argv[s+1]) : c_sizes[s];
+	char* heap = mb ? malloc (mb << 20) : NULL;
+	if (mb && !heap)
+	    return EXIT_FAILURE;
+	// Volatile, so that the stores are not optimized away
+	for (size_t i = 0; i < mb << 20; i += 4096)
+	    ((volatile char*) heap)[i] = 1;
+	struct rusage ru;
+	getrusage (RUSAGE_SELF, &ru);
+	double fork_us = launch_us (run_fork);
+	double spawn_us = launch_us (run_spawn);
+	printf ("%zu\t%ld\t%.0f\t%.0f\n", mb, ru.ru_maxrss / 1024, fork_us, spawn_us);
+	free (heap);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,31 @@
+// This file is part of Snownews - A lightweight console RSS newsreader
+//
+// Copyright (c) 2021 Mike Sharov <msharov@users.sourceforge.net>
+//
+// Snownews is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 3
+// as published by the Free Software Foundation.
+//
+// Snownews is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Snownews. If not, see http://www.gnu.org/licenses/.
+
+
+// The globals of main.c, for benchmarks linked with the snownews objects
+
+#include "../main.h"
+
+struct feed* _feed_list = NULL;
+struct feed* _unfiltered_feed_list = NULL;
+bool _feed_list_changed = false;
+struct settings _settings = { .headless = true };
+
+_Noreturn void MainQuit (const char* func, const char* error)
+{
+    fprintf (stderr, "%s: %s\n", func, error ? error : "quit");
+    exit (EXIT_FAILURE);
+}
@@ -0,0 +1,386 @@
+// This file is part of Snownews - A lightweight console RSS newsreader
+//
+// Copyright (c) 2021 Mike Sharov <msharov@users.sourceforge.net>
+//
+// Snownews is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 3
+// as published by the Free Software Foundation.
+//
+// Snownews is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Snownews. If not, see http://www.gnu.org/licenses/.
+
+#include "cache.h"
+#include "arena.h"
+#include "netio.h"
+
+//{{{ Cache file format ------------------------------------------------
+//
+// The feed cache is written in native byte order and can be used
+// directly from a memory mapping of the file. It contains:
+//	cache_header
+//	cache_field [nfields]	feed metadata, tagged for extensibility
+//	cache_item [nitems]
+//	strings [strsize]	zero-terminated, referenced by offset
+//
+// Caches written by older versions are RDF XML and are recognized
+// by not having the header magic.
+
+enum {
+    CACHE_VERSION = 1,
+    CACHE_BYTE_ORDER = 0x0102,
+    CACHE_NOSTR = UINT32_MAX	// String offset of a NULL string
+};
+static const char c_cache_magic[4] = "\177SNC";
+
+struct cache_header {
+    char magic [4];
+    uint16_t version;
+    uint16_t byteorder;
+    uint32_t nfields;
+    uint32_t nitems;
+    uint32_t strsize;
+    uint32_t reserved;
+};
+
+// Metadata field tags. Readers skip fields with unknown tags.
+enum ECacheField {
+    CACHE_FIELD_TITLE = 1,	// String: original feed title
+    CACHE_FIELD_LINK,		// String
+    CACHE_FIELD_DESCRIPTION,	// String
+    CACHE_FIELD_LASTMODIFIED,	// Number: server Last-Modified time
+    CACHE_FIELD_ETAG,		// String: server ETag
+    CACHE_FIELD_DIGEST,		// Number: genContentHash of the last download
+    CACHE_FIELD_LASTFETCH,	// Number: time of the last successful download
+    CACHE_FIELD_NEXTFETCH,	// Number: when the feed is due to be refreshed
+    CACHE_FIELD_EXPIRES,	// Number: server cache expiration time
+    CACHE_FIELD_INTERVAL,	// Number: learned refresh interval
+    CACHE_FIELD_TTL,		// Number: refresh interval set by the feed
+    CACHE_FIELD_FAILURES,	// Number: consecutive failed refreshes
+    CACHE_FIELD_FETCHSTATS	// String: download history, see FormatFetchStats
+};
+
+struct cache_field {
+    uint32_t tag;
+    uint32_t reserved;
+    uint64_t value;		// Number, or string offset
+};
+
+enum { CACHE_ITEM_READ = 1 };	// cache_item flags
+
+struct cache_item {
+    uint32_t title;		// String offsets
+    uint32_t link;
+    uint32_t description;
+    uint32_t hash;
+    int64_t date;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+//}}}-------------------------------------------------------------------
+//{{{ Download history
+//
+// The download history of the feed is stored as text, one line per
+// download, oldest first, each with the fields of struct fetchstat:
+// time namelookup connect appconnect starttransfer total redirect
+// bytes httpcode curlcode redirects decoded
+
+enum { FETCHSTAT_LINE_MAX = 128 };
+
+// Returns the download history of feed as text, or NULL if it has none
+static char* FormatFetchStats (const struct feed* feed)
+{
+    unsigned n = feed->nfetchstats < FETCH_HISTORY_SIZE ? feed->nfetchstats : FETCH_HISTORY_SIZE;
+    if (!n)
+	return NULL;
+    char* text = malloc (n * FETCHSTAT_LINE_MAX);
+    if (!text)
+	return NULL;
+    size_t len = 0;
+    for (unsigned age = n; age--;) {
+	const struct fetchstat* s = FeedFetchStat (feed, age);
+	len += snprintf (&text[len], FETCHSTAT_LINE_MAX, "%jd %u %u %u %u %u %u %u %u %u %u %u\n",
+			 (intmax_t) s->time, s->namelookup, s->connect, s->appconnect,
+			 s->starttransfer, s->total, s->redirect, s->bytes,
+			 s->httpcode, s->curlcode, s->redirects, s->decoded);
+    }
+    return text;
+}
+
+static void ParseFetchStats (struct feed* feed, const char* text)
+{
+    feed->nfetchstats = 0;
+    for (const char* line = text; line && *line;) {
+	// Copied, so that sscanf does not continue on the next line
+	char linebuf [FETCHSTAT_LINE_MAX];
+	size_t linelen = strcspn (line, "\n");
+	if (linelen >= sizeof(linebuf))
+	    break;
+	memcpy (linebuf, line, linelen);
+	linebuf[linelen] = 0;
+
+	intmax_t time;
+	unsigned v [11];
+	int n = sscanf (linebuf, "%jd %u %u %u %u %u %u %u %u %u %u %u", &time,
+			&v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9], &v[10]);
+	if (n < 11)
+	    break;
+	if (n < 12)	// Recorded before decoded size was
+	    v[10] = v[6];
+	*AddFeedFetchStat (feed) = (struct fetchstat) {
+	    .time = time,
+	    .namelookup = v[0],
+	    .connect = v[1],
+	    .appconnect = v[2],
+	    .starttransfer = v[3],
+	    .total = v[4],
+	    .redirect = v[5],
+	    .bytes = v[6],
+	    .httpcode = v[7],
+	    .curlcode = v[8],
+	    .redirects = v[9],
+	    .decoded = v[10]
+	};
+	if ((line = strchr (line, '\n')))
+	    ++line;
+    }
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Reading
+
+bool IsBinaryFeedCache (const void* data, size_t size)
+{
+    return size >= sizeof (struct cache_header) && 0 == memcmp (data, c_cache_magic, sizeof (c_cache_magic));
+}
+
+// Returns the string at offset in the table, or NULL
+static const char* cache_string (const char* strings, uint32_t strsize, uint64_t offset)
+{
+    return offset < strsize ? &strings[offset] : NULL;
+}
+
+static char* cache_strdup (const char* strings, uint32_t strsize, uint64_t offset)
+{
+    const char* s = cache_string (strings, strsize, offset);
+    return s ? strdup (s) : NULL;
+}
+
+// Loads feed from binary cache data.
+// Returns 0 on success, or 1 if the cache data is invalid.
+int ReadBinaryFeedCache (struct feed* feed, const void* data, size_t size)
+{
+    if (!IsBinaryFeedCache (data, size))
+	return 1;
+    const struct cache_header* h = data;
+    if (h->version != CACHE_VERSION || h->byteorder != CACHE_BYTE_ORDER)
+	return 1;
+    size_t fieldsz = (size_t) h->nfields * sizeof (struct cache_field);
+    size_t itemsz = (size_t) h->nitems * sizeof (struct cache_item);
+    if (size < sizeof (*h) + fieldsz + itemsz + h->strsize)
+	return 1;
+    const struct cache_field* fields = (const struct cache_field*) (h + 1);
+    const struct cache_item* citems = (const struct cache_item*) (fields + h->nfields);
+    const char* cstrings = (const char*) (citems + h->nitems);
+    // All offsets are then safe if the table ends with a terminator
+    if (h->strsize && cstrings[h->strsize - 1])
+	return 1;
+
+    for (uint32_t i = 0; i < h->nfields; ++i) {
+	const struct cache_field* f = &fields[i];
+	switch (f->tag) {
+	    case CACHE_FIELD_TITLE:
+		free (feed->title);
+		feed->title = cache_strdup (cstrings, h->strsize, f->value);
+		break;
+	    case CACHE_FIELD_LINK:
+		free (feed->link);
+		feed->link = cache_strdup (cstrings, h->strsize, f->value);
+		break;
+	    case CACHE_FIELD_DESCRIPTION:
+		free (feed->description);
+		feed->description = cache_strdup (cstrings, h->strsize, f->value);
+		break;
+	    case CACHE_FIELD_LASTMODIFIED:
+		feed->lastmodified = f->value;
+		break;
+	    case CACHE_FIELD_ETAG:
+		free (feed->etag);
+		feed->etag = cache_strdup (cstrings, h->strsize, f->value);
+		break;
+	    case CACHE_FIELD_DIGEST:
+		feed->digest = f->value;
+		break;
+	    case CACHE_FIELD_LASTFETCH:
+		feed->lastfetch = f->value;
+		break;
+	    case CACHE_FIELD_NEXTFETCH:
+		feed->nextfetch = f->value;
+		break;
+	    case CACHE_FIELD_EXPIRES:
+		feed->expires = f->value;
+		break;
+	    case CACHE_FIELD_INTERVAL:
+		feed->interval = f->value;
+		break;
+	    case CACHE_FIELD_TTL:
+		feed->ttl = f->value;
+		break;
+	    case CACHE_FIELD_FAILURES:
+		feed->failures = f->value;
+		break;
+	    case CACHE_FIELD_FETCHSTATS:
+		ParseFetchStats (feed, cache_string (cstrings, h->strsize, f->value));
+		break;
+	    default:
+		break;
+	}
+    }
+
+    // Items are created in one piece in the feed's arena, and
+    // the string table is copied there to become item strings.
+    FreeArena (feed->itemarena);
+    feed->itemarena = NULL;
+    feed->items = NULL;
+    if (h->nitems) {
+	feed->itemarena = NewArena();
+	struct newsitem* items = ArenaAlloc (feed->itemarena, h->nitems * sizeof (struct newsitem));
+	struct newsdata* idata = ArenaAlloc (feed->itemarena, h->nitems * sizeof (struct newsdata));
+	char* strings = ArenaAlloc (feed->itemarena, h->strsize);
+	if (!items || !idata || !strings)
+	    return 1;
+	memcpy (strings, cstrings, h->strsize);
+	for (uint32_t i = 0; i < h->nitems; ++i) {
+	    const struct cache_item* ci = &citems[i];
+	    idata[i] = (struct newsdata) {
+		.parent = feed,
+		.title = (char*) cache_string (strings, h->strsize, ci->title),
+		.link = (char*) cache_string (strings, h->strsize, ci->link),
+		.description = (char*) cache_string (strings, h->strsize, ci->description),
+		.hash = (char*) cache_string (strings, h->strsize, ci->hash),
+		.date = ci->date,
+		.readstatus = ci->flags & CACHE_ITEM_READ
+	    };
+	    if (!idata[i].title)
+		idata[i].title = ArenaStrdup (feed->itemarena, "Untitled");
+	    if (!idata[i].hash)
+		idata[i].hash = ArenaStrdup (feed->itemarena, "");
+	    items[i] = (struct newsitem) {
+		.data = &idata[i],
+		.next = i + 1 < h->nitems ? &items[i + 1] : NULL,
+		.prev = i ? &items[i - 1] : NULL
+	    };
+	}
+	feed->items = items;
+    }
+
+    // Same title handling as after parsing the feed
+    if (!feed->title)
+	feed->title = strdup ("Untitled");
+    free (feed->original);
+    feed->original = strdup (feed->title);
+    if (feed->custom_title) {
+	free (feed->title);
+	feed->title = strdup (feed->custom_title);
+    }
+    return 0;
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Writing
+
+struct cache_strings {
+    char* data;
+    uint32_t size;
+    uint32_t capacity;
+};
+
+// Appends s to the string table, returning its offset
+static uint32_t cache_add_string (struct cache_strings* t, const char* s)
+{
+    if (!s)
+	return CACHE_NOSTR;
+    size_t len = strlen (s) + 1;
+    if (t->size + len > t->capacity) {
+	size_t newcap = t->capacity ? 2 * t->capacity : 4096;
+	while (newcap < t->size + len)
+	    newcap *= 2;
+	if (newcap >= CACHE_NOSTR)
+	    return CACHE_NOSTR;
+	char* newdata = realloc (t->data, newcap);
+	if (!newdata)
+	    return CACHE_NOSTR;
+	t->data = newdata;
+	t->capacity = newcap;
+    }
+    uint32_t offset = t->size;
+    memcpy (&t->data[offset], s, len);
+    t->size += len;
+    return offset;
+}
+
+// Writes feed in binary cache format to f. Returns 0 on success.
+int WriteBinaryFeedCache (const struct feed* feed, FILE* f)
+{
+    unsigned nitems = 0;
+    for (const struct newsitem* item = feed->items; item; item = item->next)
+	++nitems;
+    struct cache_item* citems = calloc (nitems ? nitems : 1, sizeof (struct cache_item));
+    if (!citems)
+	return -1;
+
+    struct cache_strings strings = {};
+    char* fetchstats = FormatFetchStats (feed);
+    struct cache_field fields[] = {
+	{ CACHE_FIELD_TITLE, 0, cache_add_string (&strings, feed->original ? feed->original : feed->title) },
+	{ CACHE_FIELD_LINK, 0, cache_add_string (&strings, feed->link) },
+	{ CACHE_FIELD_DESCRIPTION, 0, cache_add_string (&strings, feed->description) },
+	{ CACHE_FIELD_LASTMODIFIED, 0, feed->lastmodified },
+	{ CACHE_FIELD_ETAG, 0, cache_add_string (&strings, feed->etag) },
+	{ CACHE_FIELD_DIGEST, 0, feed->digest },
+	{ CACHE_FIELD_LASTFETCH, 0, feed->lastfetch },
+	{ CACHE_FIELD_NEXTFETCH, 0, feed->nextfetch },
+	{ CACHE_FIELD_EXPIRES, 0, feed->expires },
+	{ CACHE_FIELD_INTERVAL, 0, feed->interval },
+	{ CACHE_FIELD_TTL, 0, feed->ttl },
+	{ CACHE_FIELD_FAILURES, 0, feed->failures },
+	{ CACHE_FIELD_FETCHSTATS, 0, cache_add_string (&strings, fetchstats) }
+    };
+    free (fetchstats);
+    unsigned i = 0;
+    for (const struct newsitem* item = feed->items; item; item = item->next, ++i) {
+	citems[i] = (struct cache_item) {
+	    .title = cache_add_string (&strings, item->data->title),
+	    .link = cache_add_string (&strings, item->data->link),
+	    .description = cache_add_string (&strings, item->data->description),
+	    .hash = cache_add_string (&strings, item->data->hash),
+	    .date = item->data->date,
+	    .flags = item->data->readstatus ? CACHE_ITEM_READ : 0
+	};
+    }
+    struct cache_header h = {
+	.version = CACHE_VERSION,
+	.byteorder = CACHE_BYTE_ORDER,
+	.nfields = sizeof(fields)/sizeof(fields[0]),
+	.nitems = nitems,
+	.strsize = strings.size
+    };
+    memcpy (h.magic, c_cache_magic, sizeof (h.magic));
+
+    int rc = 0;
+    if (fwrite (&h, sizeof (h), 1, f) != 1
+	    || fwrite (fields, sizeof (fields), 1, f) != 1
+	    || (nitems && fwrite (citems, sizeof (struct cache_item), nitems, f) != nitems)
+	    || (strings.size && fwrite (strings.data, strings.size, 1, f) != 1))
+	rc = -1;
+    free (citems);
+    free (strings.data);
+    return rc;
+}
+
+//}}}-------------------------------------------------------------------
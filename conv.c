@@ -496,6 +496,33 @@ char* genItemHash (const char* const* hashitems, unsigned items)
     return strdup (hashtext);
 }
 
+// Fast non-cryptographic digest (MurmurHash64A) of downloaded feed text,
+// used to recognize an unchanged download without parsing it.
+uint64_t genContentHash (const char* data, size_t size)
+{
+    const uint64_t m = UINT64_C(0xc6a4a7935bd1e995);
+    const unsigned r = 47;
+    uint64_t h = UINT64_C(0x736e6f776e657773) ^ (size * m);
+    for (; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+	uint64_t k;
+	memcpy (&k, data, sizeof(k));
+	k *= m;
+	k ^= k >> r;
+	k *= m;
+	h ^= k;
+	h *= m;
+    }
+    if (size) {
+	for (unsigned i = 0; i < size; ++i)
+	    h ^= (uint64_t) (uint8_t) data[i] << (8*i);
+	h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
 // Date conversion
 // 2004-11-20T19:45:00+00:00
 time_t ISODateToUnix (const char* ISODate)
@@ -522,20 +549,21 @@ time_t pubDateToUnix (const char* pubDate)
 	return 0;
 #ifdef LOCALEPATH
     // Cruft!
-    // Save old locale so we can parse the stupid pubDate format.
+    // Switch to the C locale so we can parse the stupid pubDate format.
     // However strftime is not really more intelligent since there is no
     // format string for abbr. month name NOT in the current locale. Grr.
     //
-    // This is also not thread safe!
-    char* oldlocale = setlocale (LC_TIME, NULL);
-    if (oldlocale)
-	setlocale (LC_TIME, "C");
+    // uselocale only affects this thread, as feeds are parsed on several.
+    locale_t clocale = newlocale (LC_TIME_MASK, "C", (locale_t) 0);
+    locale_t oldlocale = clocale ? uselocale (clocale) : (locale_t) 0;
 #endif
     struct tm t = { };
     char* r = strptime (pubDate + strlen ("Sat, "), "%d %b %Y %T", &t);
 #ifdef LOCALEPATH
-    if (oldlocale)
-	setlocale (LC_TIME, oldlocale);
+    if (clocale) {
+	uselocale (oldlocale);
+	freelocale (clocale);
+    }
 #endif
     if (!r)
 	return 0;
@@ -25,6 +25,7 @@ char* WrapText (const char* text, unsigned width);
 void CleanupString (char* string, bool fullclean);
 char* Hashify (const char* url);
 char* genItemHash (const char* const* hashitems, unsigned items);
+uint64_t genContentHash (const char* data, size_t size);
 time_t ISODateToUnix (const char* ISODate);
 time_t pubDateToUnix (const char* pubDate);
 char* unixToPostDateString (time_t unixDate);
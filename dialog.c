@@ -21,6 +21,7 @@
 #include "conv.h"
 #include "filters.h"
 #include "feedio.h"
+#include "netio.h"
 #include "uiutil.h"
 #include "parse.h"
 #include "setup.h"
@@ -138,6 +139,42 @@ void UIChangeFeedName (struct feed* cur_ptr)
     return;
 }
 
+// Offers to set a filter script for a new feed that could not be parsed.
+static int UINewFeedFilter (struct feed* new_ptr)
+{
+    UIStatus (_("The feed could not be parsed. Do you need a filter script for this feed? (y/n)"), 0, 0);
+    if (getch() == 'n')
+	return -1;
+    UIPerFeedFilter (new_ptr);
+    FilterPipeNG (new_ptr);
+    if (DeXML (new_ptr) != 0)
+	return -1;
+    new_ptr->problem = false;
+    new_ptr->cachedirty = true;
+    return 0;
+}
+
+// Added feed being downloaded in the background
+static const struct feed* s_added_feed = NULL;
+
+// Called by the main menu for each feed updated in the background,
+// to finish adding the new feed when its download has been parsed.
+void UIAddedFeedParsed (struct feed* cur_ptr, int rc)
+{
+    if (cur_ptr != s_added_feed)
+	return;
+    s_added_feed = NULL;
+    if (rc && UINewFeedFilter (cur_ptr) != 0)
+	UIStatus (_("There was a problem adding the feed!"), 2, 1);
+}
+
+// Called when a feed is deleted, before it is freed
+void UIAddedFeedRemoved (const struct feed* cur_ptr)
+{
+    if (cur_ptr == s_added_feed)
+	s_added_feed = NULL;
+}
+
 // Popup window to add new RSS feed. Passing an URL will
 // automatically add it, no questions asked.
 int UIAddFeed (char* newurl)
@@ -194,24 +231,26 @@ int UIAddFeed (char* newurl)
     // Don't need url text anymore.
     free (url);
 
-    // Download new feed and DeXMLize it. */
-    if (UpdateFeed (new_ptr) != 0) {
-	UIStatus (_("The feed could not be parsed. Do you need a filter script for this feed? (y/n)"), 0, 0);
-	if (getch() == 'n')
-	    return -1;
-	else {
-	    UIPerFeedFilter (new_ptr);
-	    FilterPipeNG (new_ptr);
-	    if (DeXML (new_ptr) != 0)
-		return -1;
-	    else
-		new_ptr->problem = false;
-	}
+    // Download new feed in the background. The main menu
+    // will call UIAddedFeedParsed when it is done.
+    new_ptr->cachedirty = true;
+    if (StartFeedUpdate (new_ptr)) {
+	s_added_feed = new_ptr;
+	return 0;
     }
-    new_ptr->mtime = time (NULL);
+
+    // Exec feeds are run and DeXMLized right away
+    if (UpdateFeed (new_ptr) != 0)
+	return UINewFeedFilter (new_ptr);
     return 0;
 }
 
+// Returns the time between two curl timestamps in ms
+static unsigned PhaseMs (uint32_t start, uint32_t end)
+{
+    return end > start ? (end - start) / 1000 : 0;
+}
+
 void FeedInfo (const struct feed* current_feed)
 {
     char* url = strdup (current_feed->feedurl);	// feedurl - authinfo.
@@ -221,7 +260,7 @@ void FeedInfo (const struct feed* current_feed)
     if (pauthinfo)
 	memmove (strstr (url, "://") + 3, pauthinfo + 1, strlen (pauthinfo));
 
-    UISupportDrawBox (5, 4, COLS - 6, 13);
+    UISupportDrawBox (5, 4, COLS - 6, 17);
 
     unsigned centerx = COLS / 2u;
     attron (WA_REVERSE);
@@ -274,12 +313,69 @@ void FeedInfo (const struct feed* current_feed)
     else
 	addstr (_("Feed does not use authentication."));
 
+    move (12, centerx - (COLS / 2 - 7));
+    if (current_feed->nextfetch && !current_feed->execurl && !current_feed->smartfeed) {
+	char timebuf [32] = "";
+	ctime_r (&current_feed->nextfetch, timebuf);
+	for (unsigned i = 0; i < sizeof(timebuf); ++i)
+	    if (timebuf[i] == '\n')
+		timebuf[i] = 0;
+	timebuf[sizeof(timebuf)-1] = 0;
+	printw (_("Next update: %s, every %u minutes"), timebuf, current_feed->interval / 60);
+    }
+
+    // Failure and backoff state
+    move (13, centerx - (COLS / 2 - 7));
+    if (current_feed->failures)
+	printw (_("Failed %u times in a row."), current_feed->failures);
+    time_t hostretry = current_feed->execurl || current_feed->smartfeed ? 0 : HostRetryTime (current_feed->feedurl);
+    if (hostretry) {
+	char timebuf [16] = "";
+	strftime (timebuf, sizeof(timebuf), "%H:%M", localtime (&hostretry));
+	if (current_feed->failures)
+	    addstr (" ");
+	printw (_("Server not responding, skipped until %s."), timebuf);
+    }
+
+    // Where the time of the last download went, to find slow servers
+    // Scripts only record when their output began and ended
+    const struct fetchstat* last = FeedFetchStat (current_feed, 0);
+    if (last && current_feed->execurl) {
+	move (14, centerx - (COLS / 2 - 7));
+	printw (_("Last run: exit status %u, %u bytes"), last->httpcode, last->bytes);
+	move (15, centerx - (COLS / 2 - 7));
+	printw (_("Output began after %u ms, finished after %u ms"), PhaseMs (0, last->starttransfer), PhaseMs (0, last->total));
+    } else if (last) {
+	uint32_t connected = last->appconnect ? last->appconnect : last->connect;
+	move (14, centerx - (COLS / 2 - 7));
+	printw (_("Last download: HTTP %u, %u bytes"), last->httpcode, last->bytes);
+	if (last->decoded != last->bytes)
+	    printw (_(" (%u decoded)"), last->decoded);
+	printw (_(", %u redirects"), last->redirects);
+	move (15, centerx - (COLS / 2 - 7));
+	printw (_("DNS %u ms, connect %u ms, TLS %u ms, wait %u ms, receive %u ms"),
+		PhaseMs (0, last->namelookup), PhaseMs (last->namelookup, last->connect),
+		last->appconnect ? PhaseMs (last->connect, last->appconnect) : 0,
+		PhaseMs (connected, last->starttransfer), PhaseMs (last->starttransfer, last->total));
+    }
+    if (last) {
+	unsigned n = 0, sum = 0, slowest = 0;
+	for (const struct fetchstat* s; (s = FeedFetchStat (current_feed, n)); ++n) {
+	    sum += s->total / 1000;
+	    if (slowest < s->total / 1000)
+		slowest = s->total / 1000;
+	}
+	move (16, centerx - (COLS / 2 - 7));
+	printw (current_feed->execurl ? _("Last %u runs: average %u ms, slowest %u ms")
+		: _("Last %u downloads: average %u ms, slowest %u ms"), n, sum / n, slowest);
+    }
+
     // Display filter script if any.
     if (current_feed->perfeedfilter != NULL) {
-	UISupportDrawBox (5, 13, COLS - 6, 14);
+	UISupportDrawBox (5, 17, COLS - 6, 18);
 	attron (WA_REVERSE);
-	mvaddstr (13, 7, _("Filtered through:"));
-	mvaddnstr (13, 7 + strlen (_("Filtered through:")) + 1, current_feed->perfeedfilter, COLS - 14 - strlen (_("Filtered through:")));
+	mvaddstr (17, 7, _("Filtered through:"));
+	mvaddnstr (17, 7 + strlen (_("Filtered through:")) + 1, current_feed->perfeedfilter, COLS - 14 - strlen (_("Filtered through:")));
     }
 
     UIStatus (_("Displaying feed information."), 0, 0);
@@ -305,7 +401,7 @@ void UIHelpScreen (void)
 {
     unsigned centerx = COLS / 2u, centery = LINES / 2u;
 
-    UISupportDrawBox (centerx - 20, centery - 10, centerx + 24, centery + 9);
+    UISupportDrawBox (centerx - 20, centery - 10, centerx + 24, centery + 10);
 
     attron (WA_REVERSE);
     // Keys
@@ -327,7 +423,8 @@ void UIHelpScreen (void)
     mvprintw (centery + 5, centerx - offset, "%c:", _settings.keybindings.perfeedfilter);
     mvaddstr (centery + 6, centerx - offset, _("tab:"));
     mvprintw (centery + 7, centerx - offset, "%c:", _settings.keybindings.about);
-    mvprintw (centery + 8, centerx - offset, "%c:", _settings.keybindings.quit);
+    mvprintw (centery + 8, centerx - offset, "%c:", _settings.keybindings.cancelrefresh);
+    mvprintw (centery + 9, centerx - offset, "%c:", _settings.keybindings.quit);
     // Descriptions
     mvaddstr (centery - 9, centerx - offsetstr, _("Add RSS feed..."));
     mvaddstr (centery - 8, centerx - offsetstr, _("Delete highlighted RSS feed..."));
@@ -346,7 +443,8 @@ void UIHelpScreen (void)
     mvaddstr (centery + 5, centerx - offsetstr, _("Add conversion filter..."));
     mvaddstr (centery + 6, centerx - offsetstr, _("Type Ahead Find"));
     mvaddstr (centery + 7, centerx - offsetstr, _("About"));
-    mvaddstr (centery + 8, centerx - offsetstr, _("Quit program"));
+    mvaddstr (centery + 8, centerx - offsetstr, _("Cancel refresh"));
+    mvaddstr (centery + 9, centerx - offsetstr, _("Quit program"));
     attroff (WA_REVERSE);
 
     UIStatus (_("Press the any(tm) key to exit help screen."), 0, 0);
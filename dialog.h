@@ -24,6 +24,8 @@ char* UIOneLineEntryField (int x, int y);
 void UIChangeBrowser (void);
 void UIChangeFeedName (struct feed* cur_ptr);
 int UIAddFeed (char* newurl);
+void UIAddedFeedParsed (struct feed* cur_ptr, int rc);
+void UIAddedFeedRemoved (const struct feed* cur_ptr);
 void FeedInfo (const struct feed* current_feed);
 bool UIDeleteFeed (const char* feedname);
 void CategorizeFeed (struct feed* current_feed);
@@ -0,0 +1,33 @@
+// This file is part of Snownews - A lightweight console RSS newsreader
+//
+// Snownews is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 3
+// as published by the Free Software Foundation.
+//
+// Snownews is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Snownews. If not, see http://www.gnu.org/licenses/.
+
+// Example filter plugin, passing the feed through unchanged.
+// Build with:
+//	cc -shared -fPIC -I../.. -o identity.so identity.c
+// and set the feed filter to "plugin:/path/to/identity.so"
+
+#include "snowplugin.h"
+#include <string.h>
+
+SNOWNEWS_FILTER_PLUGIN;
+
+int snownews_filter_transform (const char* in, size_t insize, struct snownews_filter_out* out)
+{
+    char* p = out->reserve (out, insize);
+    if (!p)
+	return 1;
+    memcpy (p, in, insize);
+    out->size += insize;
+    return 0;
+}
@@ -19,18 +19,152 @@
 #include "conv.h"
 #include "filters.h"
 #include "netio.h"
+#include "rxbuf.h"
 #include "uiutil.h"
 #include "parse.h"
 #include "setup.h"
 #include "cat.h"
+#include "cache.h"
 #include <ncurses.h>
 #include <libxml/parser.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 struct feed* newFeedStruct (void)
 {
     return calloc (1, sizeof (struct feed));
 }
 
+// Set title and link structure to something.
+// To the feedurl in this case so the program show something
+// as placeholder instead of crash.
+static void SetFeedPlaceholders (struct feed* cur_ptr)
+{
+    if (cur_ptr->title == NULL)
+	cur_ptr->title = strdup (cur_ptr->feedurl);
+    if (cur_ptr->link == NULL)
+	cur_ptr->link = strdup (cur_ptr->feedurl);
+}
+
+// Filter and parse the freshly retrieved cur_ptr->xmltext.
+// Returns 1 if there is nothing to parse, -1 on invalid XML.
+static int ParseFeedText (struct feed* cur_ptr)
+{
+    // Feed downloaded content through the defined filter.
+    if (cur_ptr->perfeedfilter != NULL)
+	FilterPipeNG (cur_ptr);
+
+    // If there is no feed, return.
+    if (!cur_ptr->xmltext)
+	return 1;
+
+    // Servers that ignore conditional requests resend the same feed.
+    // Recognize it by its digest and keep the already parsed items.
+    uint64_t digest = genContentHash (cur_ptr->xmltext, cur_ptr->content_length);
+    bool unchanged = (digest == cur_ptr->digest);
+    if (!unchanged) {
+	if (DeXML (cur_ptr)) {
+	    // Activate feed problem flag.
+	    cur_ptr->problem = true;
+	    return -1;
+	}
+	cur_ptr->digest = digest;
+    }
+    // We don't need these anymore. Recycle the raw XML buffer.
+    RxBufRelease (&cur_ptr->xmltext, &cur_ptr->xmlcapacity);
+    cur_ptr->content_length = 0;
+
+    // Mark the feed to be saved to the disk cache
+    if (!unchanged)
+	cur_ptr->cachedirty = true;
+    return 0;
+}
+
+//{{{ Refresh schedule -------------------------------------------------
+//
+// Each feed has its own refresh time. The refresh interval adapts to
+// how often the feed changes: it shrinks when a refresh finds new
+// content and grows when it does not, settling at about two refreshes
+// per change. The feed's <ttl> or sy:updatePeriod and the server's
+// cache expiration time are lower bounds on the delay, and a random
+// delay keeps feeds refreshed at the same time from staying together.
+// Failing feeds are retried with exponential backoff.
+
+enum {
+    REFRESH_DEFAULT_INTERVAL = 60*60,	// For feeds not refreshed yet
+    REFRESH_MIN_INTERVAL = 10*60,
+    REFRESH_MAX_INTERVAL = 24*60*60,
+    REFRESH_MAX_DELAY = 7*24*60*60	// Limit for ttl and expiration time
+};
+
+// Returns a random addition of up to a tenth of delay
+static unsigned RefreshJitter (unsigned delay)
+{
+    return rand() % (delay / 10 + 1);
+}
+
+// Sets the next refresh time of a feed that was just refreshed.
+// The interval is adapted to the result only if learn is set.
+static void ScheduleFeedRefresh (struct feed* cur_ptr, enum ERefreshResult result, bool learn)
+{
+    unsigned interval = cur_ptr->interval ? cur_ptr->interval : REFRESH_DEFAULT_INTERVAL;
+    if (learn && result == refresh_updated)
+	interval -= interval / 4;
+    else if (learn && result == refresh_unchanged)
+	interval += interval / 4;
+    if (interval < REFRESH_MIN_INTERVAL)
+	interval = REFRESH_MIN_INTERVAL;
+    else if (interval > REFRESH_MAX_INTERVAL)
+	interval = REFRESH_MAX_INTERVAL;
+    cur_ptr->interval = interval;
+
+    // Retries start at the minimum interval and double with each failure
+    unsigned delay = interval;
+    if (result >= refresh_failed) {
+	unsigned doublings = cur_ptr->failures++;
+	delay = doublings < 8 ? REFRESH_MIN_INTERVAL << doublings : REFRESH_MAX_INTERVAL;
+	if (delay > REFRESH_MAX_INTERVAL)
+	    delay = REFRESH_MAX_INTERVAL;
+    } else
+	cur_ptr->failures = 0;
+
+    time_t now = time (NULL);
+    if (delay < cur_ptr->ttl)
+	delay = cur_ptr->ttl;
+    if (cur_ptr->expires > now && (time_t) delay < cur_ptr->expires - now)
+	delay = cur_ptr->expires - now;
+    if (delay > REFRESH_MAX_DELAY)
+	delay = REFRESH_MAX_DELAY;
+    cur_ptr->nextfetch = now + delay + RefreshJitter (delay);
+
+    // Make WriteCache save the new schedule
+    cur_ptr->cachedirty = true;
+}
+
+// Parses the result of a refresh and schedules the next one.
+// Returns the ParseFeedText result, or 1 if nothing was received,
+// and how the feed changed in presult, if not NULL.
+static int FinishFeedRefresh (struct feed* cur_ptr, enum ERefreshResult* presult)
+{
+    uint64_t olddigest = cur_ptr->digest;
+    int rc = cur_ptr->xmltext ? ParseFeedText (cur_ptr) : 1;
+    enum ERefreshResult result = refresh_failed;
+    if (rc < 0)
+	result = refresh_invalid;
+    else if (!rc)
+	result = cur_ptr->digest != olddigest ? refresh_updated : refresh_unchanged;
+    else if (!cur_ptr->problem)
+	result = refresh_unchanged;	// Not modified
+
+    // The first download says nothing about how often the feed changes
+    ScheduleFeedRefresh (cur_ptr, result, olddigest || result == refresh_unchanged);
+    if (presult)
+	*presult = result;
+    return rc;
+}
+
+//}}}-------------------------------------------------------------------
+
 // Update given feed from server.
 // Reload XML document and replace in memory cur_ptr->xmltext with it.
 int UpdateFeed (struct feed* cur_ptr)
@@ -38,6 +172,9 @@ int UpdateFeed (struct feed* cur_ptr)
     if (cur_ptr == NULL)
 	return 1;
 
+    // This replaces any update running in the background
+    CancelFeedUpdate (cur_ptr);
+
     // Smart feeds are generated in the fly.
     if (cur_ptr->smartfeed == 1)
 	return 0;
@@ -47,114 +184,442 @@ int UpdateFeed (struct feed* cur_ptr)
 	FilterExecURL (cur_ptr);
     else {
 	DownloadFeed (cur_ptr->feedurl, cur_ptr);
+	SetFeedPlaceholders (cur_ptr);
+    }
+
+    int rc = FinishFeedRefresh (cur_ptr, NULL);
+    if (rc < 0)
+	UIStatus (_("Invalid XML! Cannot parse this feed!"), 2, 1);
+    return rc ? 1 : 0;
+}
 
-	// Set title and link structure to something.
-	// To the feedurl in this case so the program show something
-	// as placeholder instead of crash.
-	if (cur_ptr->title == NULL)
-	    cur_ptr->title = strdup (cur_ptr->feedurl);
-	if (cur_ptr->link == NULL)
-	    cur_ptr->link = strdup (cur_ptr->feedurl);
+//{{{ UpdateAllFeeds ---------------------------------------------------
 
-	// If the download function returns a NULL pointer return from here.
-	if (!cur_ptr->xmltext)
-	    return 1;
+static struct {
+    unsigned total;
+    unsigned done;
+    unsigned oldnumobjects;
+} s_update_progress;
+
+static void DrawUpdateProgress (void)
+{
+    const char* title = _("Updating feeds [");
+    unsigned titlestrlen = strlen (title);
+    int numobjects = s_update_progress.done * (COLS - titlestrlen - 2) / s_update_progress.total - 2;
+    if (numobjects < 1)
+	numobjects = 1;
+    if ((unsigned) numobjects > s_update_progress.oldnumobjects || !s_update_progress.done) {
+	UIStatus (title, 0, 0);
+	DrawProgressBar (numobjects, titlestrlen);
+	s_update_progress.oldnumobjects = numobjects;
     }
+}
 
-    // Feed downloaded content through the defined filter.
-    if (cur_ptr->perfeedfilter != NULL)
-	FilterPipeNG (cur_ptr);
+static void FeedUpdated (struct feed* cur_ptr __attribute__((unused)), enum ERefreshResult result __attribute__((unused)))
+{
+    ++s_update_progress.done;
+    DrawUpdateProgress();
+}
 
-    // If there is no feed, return.
-    if (!cur_ptr->xmltext)
-	return 1;
+int UpdateAllFeeds (void)
+{
+    s_update_progress.total = 0;
+    s_update_progress.done = 0;
+    s_update_progress.oldnumobjects = 0;
+    for (const struct feed* f = _feed_list; f; f = f->next)
+	if (!f->smartfeed)
+	    ++s_update_progress.total;
+    // Feeds backing off are not refreshed, so leave them out of the progress
+    unsigned nbackingoff = FeedsBackingOff (time (NULL));
+    s_update_progress.total -= nbackingoff;
+    if (s_update_progress.total) {
+	DrawUpdateProgress();
+	RefreshFeeds (true, FeedUpdated);
+    }
+    if (nbackingoff) {
+	char msgbuf [128];
+	snprintf (msgbuf, sizeof(msgbuf), _("%u failing feeds were skipped until their retry time"), nbackingoff);
+	UIStatus (msgbuf, 1, 0);
+    }
+    return 0;
+}
 
-    if (DeXML (cur_ptr)) {
-	UIStatus (_("Invalid XML! Cannot parse this feed!"), 2, 1);
-	// Activate feed problem flag.
-	cur_ptr->problem = true;
-	return 1;
+static void (*s_refreshed)(struct feed* cur_ptr, enum ERefreshResult result) = NULL;
+static unsigned s_nrefreshed = 0;
+
+// Called by the download engine for each finished feed.
+static void FeedDownloaded (struct feed* cur_ptr)
+{
+    SetFeedPlaceholders (cur_ptr);
+    enum ERefreshResult result;
+    FinishFeedRefresh (cur_ptr, &result);
+    ++s_nrefreshed;
+    if (s_refreshed)
+	s_refreshed (cur_ptr, result);
+}
+
+// Keys pressed during a refresh, other than the cancel key,
+// are given back to the UI when the refresh is done.
+static int s_heldkeys [16];
+static unsigned s_nheldkeys = 0;
+
+// Runs downloads and exec feed scripts for up to ms, or until fd,
+// if not -1, has input. Returns true if it has.
+bool RunFeedUpdates (int fd, unsigned ms)
+{
+    struct pollfd fds [DOWNLOAD_POLL_MAX];
+    unsigned nfds = 0;
+    if (fd >= 0)
+	fds[nfds++] = (struct pollfd) { .fd = fd, .events = POLLIN };
+    unsigned nexec = ExecFeedPollFds (&fds[nfds], EXEC_POOL_SIZE, &ms);
+    if (nfds + nexec)
+	RunDownloadsPoll (fds, nfds + nexec, ms);
+    else
+	RunDownloads (ms);
+    if (PendingExecFeeds())
+	ProcessExecFeeds();
+    return fd >= 0 && (fds[0].revents & POLLIN);
+}
+
+// Waits up to ms for downloads and scripts. Returns true if the
+// user pressed the cancel key.
+static bool RunRefreshDownloads (unsigned ms)
+{
+    if (!RunFeedUpdates (_settings.headless ? -1 : STDIN_FILENO, ms))
+	return false;
+    timeout (0);
+    int key = getch();
+    timeout (-1);
+    if (key == _settings.keybindings.cancelrefresh)
+	return true;
+    if (key != ERR && s_nheldkeys < sizeof(s_heldkeys)/sizeof(s_heldkeys[0]))
+	s_heldkeys[s_nheldkeys++] = key;
+    return false;
+}
+
+static void ReturnHeldKeys (void)
+{
+    // ungetch is a stack, so the last key goes first
+    while (s_nheldkeys)
+	ungetch (s_heldkeys[--s_nheldkeys]);
+}
+
+// Returns true if the feed is due to be refreshed. With early set,
+// feeds are refreshed before they are due, except those backing off.
+static bool FeedRefreshDue (const struct feed* cur_ptr, time_t now, bool early)
+{
+    return cur_ptr->nextfetch <= now || (early && !cur_ptr->failures);
+}
+
+// Returns the number of feeds a full refresh skips, because they
+// are backing off after failures.
+unsigned FeedsBackingOff (time_t now)
+{
+    unsigned n = 0;
+    for (const struct feed* f = _feed_list; f; f = f->next)
+	if (!f->smartfeed && !FeedRefreshDue (f, now, true))
+	    ++n;
+    return n;
+}
+
+// Refreshes all feeds, or with all unset only those due, waiting until
+// done. Feeds backing off after failures are only refreshed when due.
+// Network feeds are downloaded and exec feed scripts run concurrently,
+// parsing each one as soon as it arrives.
+// The refresh stops at the refresh timeout, or when the user presses
+// the cancel key; the feeds not refreshed by then keep their items.
+// Calls refreshed with the result of each. Returns the number refreshed.
+unsigned RefreshFeeds (bool all, void (*refreshed)(struct feed* cur_ptr, enum ERefreshResult result))
+{
+    s_refreshed = refreshed;
+    s_nrefreshed = 0;
+    time_t now = time (NULL);
+    time_t deadline = _settings.refreshtimeout ? now + _settings.refreshtimeout : 0;
+    SetDownloadDeadline (deadline);
+    for (struct feed* f = _feed_list; f; f = f->next) {
+	if (f->smartfeed || !FeedRefreshDue (f, now, all))
+	    continue;
+	if (!(f->execurl ? QueueExecFeed (f, FeedDownloaded) : QueueFeedDownload (f, FeedDownloaded))) {
+	    f->problem = true;
+	    FeedDownloaded (f);
+	}
     }
-    // We don't need these anymore. Free the raw XML to save some memory.
-    free (cur_ptr->xmltext);
-    cur_ptr->xmltext = NULL;
-    cur_ptr->content_length = 0;
+    bool cancelled = false;
+    while ((PendingDownloads() || PendingExecFeeds()) && !cancelled) {
+	cancelled = RunRefreshDownloads (100);
+	// The downloads are stopped by the download engine
+	if (deadline && PendingExecFeeds() && time (NULL) >= deadline) {
+	    char msgbuf [128];
+	    snprintf (msgbuf, sizeof(msgbuf), _("Refresh took too long, %u feeds were not updated"), CancelAllExecFeeds());
+	    UIStatus (msgbuf, 1, 1);
+	    syslog (LOG_WARNING, "%s", msgbuf);
+	}
+    }
+    if (cancelled) {
+	CancelAllDownloads();
+	CancelAllExecFeeds();
+	UIStatus (_("Refresh cancelled"), 1, 0);
+    }
+    s_refreshed = NULL;
+    SetDownloadDeadline (0);
+    ReturnHeldKeys();
+    RxBufTrim();
+    return s_nrefreshed;
+}
 
-    // Mark the time to detect modifications
-    cur_ptr->mtime = time (NULL);
-    return 0;
+//}}}-------------------------------------------------------------------
+//{{{ Background updates -----------------------------------------------
+//
+// The UI downloads feeds in the background while it waits for keys.
+// The downloaded feeds are parsed only when the UI is ready for their
+// items to change, by calling FinishFeedUpdates.
+
+static struct feed** s_downloaded = NULL;	// Feeds waiting to be parsed
+static unsigned s_ndownloaded = 0;
+static unsigned s_downloadedcap = 0;
+
+static void FeedDownloadedInBackground (struct feed* cur_ptr)
+{
+    for (unsigned i = 0; i < s_ndownloaded; ++i)
+	if (s_downloaded[i] == cur_ptr)
+	    return;
+    if (s_ndownloaded >= s_downloadedcap) {
+	unsigned newcap = s_downloadedcap ? 2 * s_downloadedcap : 16;
+	struct feed** newq = realloc (s_downloaded, newcap * sizeof (struct feed*));
+	if (!newq)
+	    return;
+	s_downloaded = newq;
+	s_downloadedcap = newcap;
+    }
+    s_downloaded[s_ndownloaded++] = cur_ptr;
 }
 
-int UpdateAllFeeds (void)
+// Starts downloading the feed, or running its script, in the background.
+// Returns false if the feed can not be updated in the background.
+bool StartFeedUpdate (struct feed* cur_ptr)
 {
-    for (struct feed* f = _feed_list; f; f = f->next)
-	if (0 != UpdateFeed (f))
+    if (cur_ptr->smartfeed)
+	return false;
+    // Something to show in the list before the download completes
+    SetFeedPlaceholders (cur_ptr);
+    if (cur_ptr->execurl)
+	return ExecFeedPending (cur_ptr) || QueueExecFeed (cur_ptr, FeedDownloadedInBackground);
+    // Background updates started together share the refresh timeout
+    if (!PendingDownloads() && _settings.refreshtimeout)
+	SetDownloadDeadline (time (NULL) + _settings.refreshtimeout);
+    return FeedDownloadPending (cur_ptr) || QueueFeedDownload (cur_ptr, FeedDownloadedInBackground);
+}
+
+static bool FeedUpdatePending (const struct feed* cur_ptr)
+{
+    for (unsigned i = 0; i < s_ndownloaded; ++i)
+	if (s_downloaded[i] == cur_ptr)
+	    return true;
+    return FeedDownloadPending (cur_ptr) || ExecFeedPending (cur_ptr);
+}
+
+// Starts background updates of the feeds due to be refreshed.
+// Exec feed scripts are only run when asked for.
+// Feeds never refreshed are spread over the default interval.
+// Returns the number of updates started.
+unsigned StartDueFeedUpdates (void)
+{
+    time_t now = time (NULL);
+    unsigned n = 0;
+    for (struct feed* f = _feed_list; f; f = f->next) {
+	if (f->smartfeed || f->execurl || FeedUpdatePending (f))
 	    continue;
-    return 0;
+	if (!f->nextfetch)
+	    f->nextfetch = now + rand() % REFRESH_DEFAULT_INTERVAL;
+	else if (f->nextfetch <= now) {
+	    // Rescheduled when finished, retried later if that fails
+	    f->nextfetch = now + REFRESH_MIN_INTERVAL;
+	    n += StartFeedUpdate (f);
+	}
+    }
+    return n;
 }
 
-// Load feed from disk. And call UpdateFeed if neccessary.
-int LoadFeed (struct feed* cur_ptr)
+// Returns the earliest refresh time of the scheduled feeds that
+// can be refreshed in the background, or 0 if there are none.
+// Feeds already being updated are rescheduled when they finish.
+time_t NextFeedRefresh (void)
 {
-    // Smart feeds are generated in the fly.
-    if (cur_ptr->smartfeed == 1)
-	return 0;
+    time_t next = 0;
+    for (const struct feed* f = _feed_list; f; f = f->next)
+	if (!f->smartfeed && !f->execurl && f->nextfetch && (!next || f->nextfetch < next) && !FeedUpdatePending (f))
+	    next = f->nextfetch;
+    return next;
+}
+
+// Starts updating all feeds in the background, except those backing off
+// after failures. Returns the number of feeds skipped.
+unsigned StartAllFeedsUpdate (void)
+{
+    time_t now = time (NULL);
+    for (struct feed* f = _feed_list; f; f = f->next)
+	if (FeedRefreshDue (f, now, true))
+	    StartFeedUpdate (f);
+    return FeedsBackingOff (now);
+}
+
+// Number of feeds being updated in the background, including the
+// downloaded ones waiting for FinishFeedUpdates.
+unsigned PendingFeedUpdates (void)
+{
+    return PendingDownloads() + PendingExecFeeds() + s_ndownloaded;
+}
+
+// Returns true if there are downloaded feeds waiting to be parsed
+bool FeedUpdatesReady (void)
+{
+    return s_ndownloaded;
+}
+
+// Parses the feeds downloaded in the background. Calls parsed with
+// the result of each, which is nonzero if it could not be loaded.
+// Returns the number of feeds parsed.
+unsigned FinishFeedUpdates (void (*parsed)(struct feed* cur_ptr, int rc))
+{
+    unsigned n = 0;
+    while (s_ndownloaded) {
+	// Take one at a time, parsed may change the queue
+	struct feed* f = s_downloaded[0];
+	memmove (&s_downloaded[0], &s_downloaded[1], --s_ndownloaded * sizeof (struct feed*));
+	int rc = FinishFeedRefresh (f, NULL);
+	if (parsed)
+	    parsed (f, rc);
+	++n;
+    }
+    // Receive buffers are kept only while feeds are being refreshed
+    if (!PendingFeedUpdates())
+	RxBufTrim();
+    return n;
+}
+
+// Stops the background downloads. The feeds already downloaded are
+// still parsed. Returns the number of feeds not updated.
+unsigned CancelFeedUpdates (void)
+{
+    return CancelAllDownloads() + CancelAllExecFeeds();
+}
+
+// Stops any background update of the feed. Must be called before freeing it.
+void CancelFeedUpdate (struct feed* cur_ptr)
+{
+    CancelFeedDownload (cur_ptr);
+    CancelExecFeed (cur_ptr);
+    for (unsigned i = 0; i < s_ndownloaded; ++i) {
+	if (s_downloaded[i] == cur_ptr) {
+	    memmove (&s_downloaded[i], &s_downloaded[i+1], (--s_ndownloaded - i) * sizeof (struct feed*));
+	    break;
+	}
+    }
+}
 
+//}}}-------------------------------------------------------------------
+//{{{ LoadAllFeeds -----------------------------------------------------
+
+// Reads the feed from its disk cache. This runs on the cache loader
+// threads and must not touch the UI. Returns 0 on success, -1 if there
+// is no cache file, and 1 if the cache could not be read.
+static int ReadFeedCache (struct feed* cur_ptr)
+{
     char* hashme = Hashify (cur_ptr->feedurl);
     char cachefilename [PATH_MAX];
     CacheFilePath (hashme, cachefilename, sizeof(cachefilename));
     free (hashme);
-    FILE* cache = fopen (cachefilename, "r");
-    if (cache == NULL) {
+    int fd = open (cachefilename, O_RDONLY);
+    if (fd < 0)
+	return -1;
+
+    struct stat cachest;
+    void* cachedata = MAP_FAILED;
+    if (0 == fstat (fd, &cachest) && cachest.st_size > 0)
+	cachedata = mmap (NULL, cachest.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+
+    // The cache is normally in binary format and is used from the mapping.
+    // Caches from older versions are XML, and are parsed and then marked
+    // as modified to be rewritten in the binary format.
+    int rc = 1;
+    if (cachedata != MAP_FAILED) {
+	if (IsBinaryFeedCache (cachedata, cachest.st_size)) {
+	    rc = ReadBinaryFeedCache (cur_ptr, cachedata, cachest.st_size);
+	    cur_ptr->cachedirty = false;
+	} else {
+	    struct feed_parser* p = NewFeedParser (cur_ptr);
+	    if (p) {
+		FeedParserChunk (p, cachedata, cachest.st_size);
+		rc = FinishFeedParser (p);
+	    }
+	    cur_ptr->cachedirty = true;	// Make WriteCache replace it
+	}
+	munmap (cachedata, cachest.st_size);
+    }
+    return rc ? 1 : 0;
+}
+
+// Downloads the feed that could not be loaded from cache.
+// cacherc is the return value of ReadFeedCache.
+static int RecoverFeed (struct feed* cur_ptr, int cacherc)
+{
+    if (cacherc < 0) {
 	char msgbuf[128];
 	snprintf (msgbuf, sizeof (msgbuf), _("Cache for %s is toast. Reloading from server..."), cur_ptr->feedurl);
 	UIStatus (msgbuf, 0, 0);
 
 	if (UpdateFeed (cur_ptr) != 0)
 	    return 1;
-	return 0;
-    }
-
-    struct stat cachest;
-    fstat (fileno (cache), &cachest);
-
-    // Read complete cachefile.
-    int len = 0;		// Internal usage for realloc.
-    char filebuf[BUFSIZ];	// File I/O block buffer.
-    while (!feof (cache)) {
-	// Use binary read, UTF-8 data!
-	size_t retval = fread (filebuf, 1, sizeof (filebuf), cache);
-	if (retval == 0)
-	    break;
-	cur_ptr->xmltext = realloc (cur_ptr->xmltext, len + retval + 1);
-	memcpy (cur_ptr->xmltext + len, filebuf, retval);
-	len += retval;
-	if (retval != sizeof (filebuf))
-	    break;
-    }
-    fclose (cache);
-    cur_ptr->content_length = len;
-    cur_ptr->xmltext[len] = '\0';
-
-    if (!cur_ptr->xmltext)
-	return 1;
-
-    // After loading DeXMLize the mess.
-    // If loading the feed from the disk fails, try downloading from the net.
-    if (DeXML (cur_ptr) != 0 && UpdateFeed (cur_ptr) != 0) {
-	// And if that fails as well, just continue without this feed.
+    } else if (cacherc > 0 && UpdateFeed (cur_ptr) != 0) {
+	// If that fails as well, just continue without this feed.
 	char msgbuf[64];
 	snprintf (msgbuf, sizeof (msgbuf), _("Could not load %s!"), cur_ptr->feedurl);
 	UIStatus (msgbuf, 2, 1);
     }
-
-    free (cur_ptr->xmltext);
-    cur_ptr->xmltext = NULL;
-    cur_ptr->content_length = 0;
-    cur_ptr->mtime = cachest.st_mtime;
     return 0;
 }
 
+// Load feed from disk. And call UpdateFeed if neccessary.
+int LoadFeed (struct feed* cur_ptr)
+{
+    // Smart feeds are generated in the fly.
+    if (cur_ptr->smartfeed == 1)
+	return 0;
+    return RecoverFeed (cur_ptr, ReadFeedCache (cur_ptr));
+}
+
+// Cache files are read and parsed on a pool of threads
+// while the main thread draws the progress bar.
+enum { MAX_CACHE_LOADERS = 16 };
+
+struct cache_loader {
+    struct feed** feeds;
+    int* results;		// ReadFeedCache return values
+    unsigned nfeeds;
+    unsigned next;		// Next feed to load
+    unsigned done;		// Number of feeds loaded
+    pthread_mutex_t lock;
+    pthread_cond_t progress;	// Signaled when a feed is loaded
+};
+
+static void* CacheLoaderThread (void* vl)
+{
+    struct cache_loader* l = vl;
+    pthread_mutex_lock (&l->lock);
+    while (l->next < l->nfeeds) {
+	unsigned i = l->next++;
+	pthread_mutex_unlock (&l->lock);
+	int rc = ReadFeedCache (l->feeds[i]);
+	pthread_mutex_lock (&l->lock);
+	l->results[i] = rc;
+	++l->done;
+	pthread_cond_signal (&l->progress);
+    }
+    pthread_mutex_unlock (&l->lock);
+    return NULL;
+}
+
 int LoadAllFeeds (unsigned numfeeds)
 {
     if (!numfeeds)
@@ -162,33 +627,109 @@ int LoadAllFeeds (unsigned numfeeds)
     UIStatus (_("Loading cache ["), 0, 0);
     unsigned titlestrlen = strlen (_("Loading cache ["));
     int oldnumobjects = 0;
-    unsigned count = 1;
-    for (struct feed* f = _feed_list; f; f = f->next) {
+
+    struct cache_loader l = {
+	.feeds = calloc (numfeeds, sizeof (struct feed*)),
+	.results = calloc (numfeeds, sizeof (int)),
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.progress = PTHREAD_COND_INITIALIZER
+    };
+    if (!l.feeds || !l.results) {
+	free (l.feeds);
+	free (l.results);
+	return 1;
+    }
+    for (struct feed* f = _feed_list; f && l.nfeeds < numfeeds; f = f->next)
+	if (!f->smartfeed)	// Smart feeds are generated in the fly.
+	    l.feeds[l.nfeeds++] = f;
+
+    // libxml must be initialized before it is used on several threads
+    xmlInitParser();
+    long ncpus = sysconf (_SC_NPROCESSORS_ONLN);
+    unsigned nthreads = ncpus < 1 ? 1 : ncpus;
+    if (nthreads > MAX_CACHE_LOADERS)
+	nthreads = MAX_CACHE_LOADERS;
+    if (nthreads > l.nfeeds)
+	nthreads = l.nfeeds;
+    pthread_t threads [MAX_CACHE_LOADERS];
+    unsigned nstarted = 0;
+    while (nstarted < nthreads && 0 == pthread_create (&threads[nstarted], NULL, CacheLoaderThread, &l))
+	++nstarted;
+    if (!nstarted)
+	CacheLoaderThread (&l);
+
+    pthread_mutex_lock (&l.lock);
+    for (;;) {
 	// Progress bar
-	int numobjects = count * (COLS - titlestrlen - 2) / numfeeds - 2;
+	int numobjects = (l.done + 1) * (COLS - titlestrlen - 2) / numfeeds - 2;
 	if (numobjects < 1)
 	    numobjects = 1;
 	if (numobjects > oldnumobjects) {
 	    DrawProgressBar (numobjects, titlestrlen);
 	    oldnumobjects = numobjects;
 	}
-	if (LoadFeed (f) != 0)
+	if (l.done >= l.nfeeds)
+	    break;
+	pthread_cond_wait (&l.progress, &l.lock);
+    }
+    pthread_mutex_unlock (&l.lock);
+    for (unsigned i = 0; i < nstarted; ++i)
+	pthread_join (threads[i], NULL);
+
+    // Feeds without a usable cache are downloaded in list order.
+    // Without the UI, they are left due for the refresh that follows.
+    for (unsigned i = 0; i < l.nfeeds; ++i) {
+	if (!l.results[i])
 	    continue;
-	++count;
+	if (_settings.headless)
+	    l.feeds[i]->nextfetch = 0;
+	else
+	    RecoverFeed (l.feeds[i], l.results[i]);
     }
+
+    pthread_mutex_destroy (&l.lock);
+    pthread_cond_destroy (&l.progress);
+    free (l.feeds);
+    free (l.results);
     return 0;
 }
 
+//}}}-------------------------------------------------------------------
+
+// The last feed added to the list, remembered with the list head it was
+// added to. Loading the url list appends thousands of feeds, so walking
+// to the end of the list on every append would be quadratic.
+static struct feed* s_feed_list_head = NULL;
+static struct feed* s_feed_list_tail = NULL;
+
 void AddFeedToList (struct feed* new_feed)
 {
     if (!_feed_list)
 	_feed_list = new_feed;
     else {
-	new_feed->prev = _feed_list;
-	while (new_feed->prev->next)
-	    new_feed->prev = new_feed->prev->next;
-	new_feed->prev->next = new_feed;
+	// The list may have been reordered or swapped for the
+	// category filtered list; walk it again if so.
+	struct feed* tail = s_feed_list_tail;
+	if (s_feed_list_head != _feed_list || !tail || tail->next)
+	    for (tail = _feed_list; tail->next; tail = tail->next) {}
+	new_feed->prev = tail;
+	tail->next = new_feed;
     }
+    s_feed_list_head = _feed_list;
+    s_feed_list_tail = new_feed;
+}
+
+void RemoveFeedFromList (struct feed* feed)
+{
+    if (feed->prev)
+	feed->prev->next = feed->next;
+    else if (_feed_list == feed)
+	_feed_list = feed->next;
+    if (feed->next)
+	feed->next->prev = feed->prev;
+    feed->next = feed->prev = NULL;
+    if (feed == s_feed_list_head || feed == s_feed_list_tail)
+	s_feed_list_head = s_feed_list_tail = NULL;
 }
 
 void AddFeed (const char* url, const char* cname, const char* categories, const char* filter)
@@ -287,7 +828,7 @@ static void WriteFeedUrls (void)
     _feed_list_changed = false;
 }
 
-static void WriteFeedCache (const struct feed* feed)
+static void WriteFeedCache (struct feed* feed)
 {
     char* hashme = Hashify (feed->feedurl);
     char cachefilename [PATH_MAX];
@@ -295,8 +836,7 @@ static void WriteFeedCache (const struct feed* feed)
     free (hashme);
 
     // Check if the feed has been modified since last loaded from this file
-    struct stat cachest;
-    if (0 == stat (cachefilename, &cachest) && cachest.st_mtime >= feed->mtime)
+    if (!feed->cachedirty && 0 == access (cachefilename, F_OK))
 	return;
 
     FILE* cache = fopen (cachefilename, "w");
@@ -305,65 +845,13 @@ static void WriteFeedCache (const struct feed* feed)
 	return;
     }
 
-    fputs (
-	"<?xml version=\"1.0\" ?>\n\n"
-	"<rdf:RDF\n"
-	"\txmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\"\n"
-	"\txmlns=\"http://purl.org/rss/1.0/\"\n"
-	"\txmlns:snow=\"http://snownews.kcore.de/ns/1.0/\">\n\n", cache);
-
-    if (feed->lastmodified)
-	fprintf (cache, "<snow:lastmodified>%ld</snow:lastmodified>\n", feed->lastmodified);
-
-    char* encoded = (char*) xmlEncodeEntitiesReentrant (NULL, (xmlChar*) feed->feedurl);
-    fprintf (cache, "<channel rdf:about=\"%s\">\n<title>", encoded);
-    free (encoded);
-
-    if (feed->original)
-	fprintf (cache, "<![CDATA[%s]]>", feed->original);
-    else if (feed->title)
-	fprintf (cache, "<![CDATA[%s]]>", feed->title);
-    fputs ("</title>\n<link>", cache);
-    if (feed->link) {
-	encoded = (char*) xmlEncodeEntitiesReentrant (NULL, (xmlChar*) feed->link);
-	fputs (encoded, cache);
-	free (encoded);
-    }
-    fputs ("</link>\n<description>", cache);
-    if (feed->description)
-	fprintf (cache, "<![CDATA[%s]]>", feed->description);
-    fputs ("</description>\n</channel>\n\n", cache);
-
-    for (const struct newsitem * item = feed->items; item; item = item->next) {
-	fputs ("<item rdf:about=\"", cache);
-	if (item->data->link) {
-	    encoded = (char*) xmlEncodeEntitiesReentrant (NULL, (xmlChar*) item->data->link);
-	    fputs (encoded, cache);
-	    free (encoded);
-	}
-	fputs ("\">\n<title>", cache);
-	if (item->data->title)
-	    fprintf (cache, "<![CDATA[%s]]>", item->data->title);
-	fputs ("</title>\n<link>", cache);
-	if (item->data->link) {
-	    encoded = (char*) xmlEncodeEntitiesReentrant (NULL, (xmlChar*) item->data->link);
-	    fputs (encoded, cache);
-	    free (encoded);
-	}
-	fputs ("</link>\n<description>", cache);
-	if (item->data->description)
-	    fprintf (cache, "<![CDATA[%s]]>", item->data->description);
-	fputs ("</description>\n<snow:readstatus>", cache);
-	putc ('0' + item->data->readstatus, cache);
-	fputs ("</snow:readstatus>\n<snow:hash>", cache);
-	if (item->data->hash)
-	    fputs (item->data->hash, cache);
-	fputs ("</snow:hash>\n", cache);
-	fprintf (cache, "<snow:date>%u</snow:date>\n", item->data->date);
-	fputs ("</item>\n\n", cache);
-    }
-    fputs ("</rdf:RDF>", cache);
-    fclose (cache);
+    int rc = WriteBinaryFeedCache (feed, cache);
+    if (0 != fclose (cache))
+	rc = -1;
+    if (0 != rc)
+	syslog (LOG_ERR, "error writing cache file '%s': %s", cachefilename, strerror (errno));
+    else
+	feed->cachedirty = false;
 }
 
 // Write in memory structures to disk cache.
@@ -383,7 +871,7 @@ void WriteCache (void)
     int oldnumobjects = 0;
     unsigned titlestrlen = strlen (_("Saving settings ["));
 
-    for (const struct feed* cur_ptr = _feed_list; cur_ptr; cur_ptr = cur_ptr->next) {
+    for (struct feed* cur_ptr = _feed_list; cur_ptr; cur_ptr = cur_ptr->next) {
 	// Progress bar
 	int numobjects = count * (COLS - titlestrlen - 2) / numfeeds - 2;
 	if (numobjects < 1)
@@ -17,11 +17,27 @@
 #pragma once
 #include "main.h"
 
+// Result of a feed refresh
+enum ERefreshResult { refresh_updated, refresh_unchanged, refresh_failed, refresh_invalid };
+
 struct feed* newFeedStruct (void);
 int UpdateFeed (struct feed* cur_ptr);
 int UpdateAllFeeds (void);
+unsigned RefreshFeeds (bool all, void (*refreshed)(struct feed* cur_ptr, enum ERefreshResult result));
+unsigned FeedsBackingOff (time_t now);
+bool StartFeedUpdate (struct feed* cur_ptr);
+unsigned StartDueFeedUpdates (void);
+bool RunFeedUpdates (int fd, unsigned ms);
+time_t NextFeedRefresh (void);
+unsigned StartAllFeedsUpdate (void);
+unsigned PendingFeedUpdates (void);
+bool FeedUpdatesReady (void);
+unsigned FinishFeedUpdates (void (*parsed)(struct feed* cur_ptr, int rc));
+unsigned CancelFeedUpdates (void);
+void CancelFeedUpdate (struct feed* cur_ptr);
 int LoadFeed (struct feed* cur_ptr);
 int LoadAllFeeds (unsigned numfeeds);
 void AddFeedToList (struct feed* new_feed);
+void RemoveFeedFromList (struct feed* feed);
 void AddFeed (const char* url, const char* cname, const char* categories, const char* filter);
 void WriteCache (void);
@@ -17,41 +17,456 @@
 #include "filters.h"
 #include "uiutil.h"
 #include "conv.h"
+#include "rxbuf.h"
+#include "netio.h"
+#include "snowplugin.h"
+#include <dlfcn.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
 
 //----------------------------------------------------------------------
 
-static int pipe_command_buf (const char* command, char** argv, const void* inbuf, size_t inbuf_size, char** outbuf, unsigned* outbuf_size);
+static int pipe_command_buf (const char* command, char** argv, const void* inbuf, size_t inbuf_size, char** outbuf, unsigned* outbuf_size, unsigned* outbuf_capacity);
+static int coproc_command_buf (const char* cmdline, char** argv, const void* inbuf, size_t inbuf_size, char** outbuf, unsigned* outbuf_size, unsigned* outbuf_capacity);
+static int plugin_filter_buf (const char* path, const char* inbuf, size_t inbuf_size, char** outbuf, unsigned* outbuf_size, unsigned* outbuf_capacity);
 
 //----------------------------------------------------------------------
+//{{{ Child processes
+//
+// Scripts and filters are started with posix_spawn, which does not copy
+// the page tables of snownews, so starting them does not get slower as
+// more feeds are loaded.
 
-// Load output of local script. Must be valid RSS.
-int FilterExecURL (struct feed* cur_ptr)
+// Commands with these need the shell; others are run directly
+#define SHELL_CHARS	"|&;<>()$`\\\"'\t\n*?[]#~=%{}"
+
+// Splits cmdline in place at spaces. Returns a NULL-terminated
+// argument array pointing into cmdline, to be freed.
+static char** split_args (char* cmdline)
+{
+    char** argv = malloc (sizeof (char*));
+    size_t argc = 0;
+    for (char* arg; argv && (arg = strsep (&cmdline, " "));) {
+	if (!*arg)
+	    continue;
+	char** newargv = realloc (argv, sizeof (char*) * (argc + 2));
+	if (!newargv) {
+	    free (argv);
+	    return NULL;
+	}
+	argv = newargv;
+	argv[argc++] = arg;
+    }
+    if (argv)
+	argv[argc] = NULL;
+    return argv;
+}
+
+// Spawn attributes for scripts and filters. They get the default SIGPIPE
+// action, which snownews ignores, and with pgroup, a process group of
+// their own, to be killed with all their children.
+static void spawn_attr_init (posix_spawnattr_t* attr, bool pgroup)
+{
+    posix_spawnattr_init (attr);
+    sigset_t sigs;
+    sigemptyset (&sigs);
+    sigaddset (&sigs, SIGPIPE);
+    posix_spawnattr_setsigdefault (attr, &sigs);
+    short flags = POSIX_SPAWN_SETSIGDEF;
+    if (pgroup) {
+	posix_spawnattr_setpgroup (attr, 0);
+	flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    posix_spawnattr_setflags (attr, flags);
+}
+
+// Runs command with its arguments directly if it is a plain list of
+// words, or otherwise with the shell. Returns 0 or an errno value.
+static int spawn_command (pid_t* pid, const char* command, const posix_spawn_file_actions_t* fa, const posix_spawnattr_t* attr)
+{
+    if (strpbrk (command, SHELL_CHARS)) {
+	char* argv[] = { "sh", "-c", (char*) command, NULL };
+	return posix_spawn (pid, "/bin/sh", fa, attr, argv, environ);
+    }
+    char* cmdline = strdup (command);
+    char** argv = cmdline ? split_args (cmdline) : NULL;
+    int err = !argv ? ENOMEM : !argv[0] ? ENOENT : posix_spawnp (pid, argv[0], fa, attr, argv, environ);
+    free (argv);
+    free (cmdline);
+    return err;
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Exec feeds -------------------------------------------------------
+//
+// Exec feed scripts run as a pool of child processes. Their output is
+// read as it arrives, while the caller waits in poll for the scripts
+// together with the downloads and the keyboard. A script running longer
+// than the feed timeout is killed, along with any children it started.
+// Scripts run in process groups of their own, which the SIGCHLD handler
+// leaves alone, so their exit status is collected here.
+
+struct execjob {
+    struct execjob*	next;
+    struct feed*	feed;
+    void		(*done)(struct feed* fp);
+    pid_t		pid;		// 0 while queued
+    int			fd;		// Read end of the script's stdout, -1 once closed
+    int			status;		// Exit status, -1 while running
+    struct timespec	start;
+    uint32_t		firstoutput;	// Microseconds until output began
+    char*		data;
+    unsigned		size;
+    unsigned		capacity;
+};
+
+enum { EXEC_REAP_INTERVAL = 50 };	// ms between checks for a script to exit
+
+static struct execjob* s_exec_queue = NULL;
+static struct execjob* s_exec_queue_last = NULL;
+static unsigned s_exec_nqueued = 0;
+static struct execjob* s_exec_active = NULL;
+static unsigned s_exec_nactive = 0;
+
+// The command follows the exec: prefix
+static const char* ExecCommand (const struct feed* fp)
+{
+    const char* command = strchr (fp->feedurl, ':');
+    return command ? command + 1 : fp->feedurl;
+}
+
+static unsigned ExecPoolSize (void)
+{
+    unsigned n = _settings.maxdownloads;
+    return n < 1 ? 1 : n > EXEC_POOL_SIZE ? EXEC_POOL_SIZE : n;
+}
+
+// Microseconds since the script was started
+static uint32_t ExecJobTime (const struct execjob* j)
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    int64_t us = (now.tv_sec - j->start.tv_sec) * 1000000 + (now.tv_nsec - j->start.tv_nsec) / 1000;
+    return us < 0 ? 0 : us > UINT32_MAX ? UINT32_MAX : (uint32_t) us;
+}
+
+// Milliseconds until the script times out, UINT_MAX without a timeout
+static unsigned ExecJobTimeLeft (const struct execjob* j)
+{
+    if (!_settings.feedtimeout)
+	return UINT_MAX;
+    uint64_t used = ExecJobTime (j) / 1000, limit = _settings.feedtimeout * 1000ull;
+    return used < limit ? limit - used : 0;
+}
+
+static bool StartExecJob (struct execjob* j)
+{
+    enum { READ_END, WRITE_END, N_ENDS };
+    int output_pipe [N_ENDS];
+    if (0 != pipe2 (output_pipe, O_CLOEXEC))
+	return false;
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init (&fa);
+    posix_spawn_file_actions_adddup2 (&fa, output_pipe[WRITE_END], STDOUT_FILENO);
+    // The terminal belongs to the UI
+    posix_spawn_file_actions_addopen (&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawnattr_t attr;
+    spawn_attr_init (&attr, true);
+    pid_t pid;
+    int err = spawn_command (&pid, ExecCommand (j->feed), &fa, &attr);
+    posix_spawnattr_destroy (&attr);
+    posix_spawn_file_actions_destroy (&fa);
+    close (output_pipe[WRITE_END]);
+    if (err) {
+	close (output_pipe[READ_END]);
+	errno = err;
+	return false;
+    }
+    fcntl (output_pipe[READ_END], F_SETFL, O_NONBLOCK);
+    j->pid = pid;
+    j->fd = output_pipe[READ_END];
+    clock_gettime (CLOCK_MONOTONIC, &j->start);
+    return true;
+}
+
+// Reads all the output available. Returns true at the end of it.
+static bool ReadExecJob (struct execjob* j)
+{
+    for (;;) {
+	if (!RxBufReserve (&j->data, &j->capacity, j->size, j->size + BUFSIZ + 1))
+	    return true;
+	ssize_t br = read (j->fd, &j->data[j->size], j->capacity - j->size - 1);
+	if (br > 0) {
+	    if (!j->size)
+		j->firstoutput = ExecJobTime (j);
+	    j->size += br;
+	} else if (br < 0 && errno == EINTR)
+	    continue;
+	else
+	    return !(br < 0 && errno == EAGAIN);
+    }
+}
+
+// Reaps the script, killing it first when kill_it. Returns false if it
+// is still running. Otherwise stores its exit status in j->status, with
+// 128 added to a killing signal like the shell does.
+static bool ReapExecJob (struct execjob* j, bool kill_it)
+{
+    if (kill_it)
+	kill (-j->pid, SIGKILL);
+    int status = 0;
+    pid_t r;
+    while (0 > (r = waitpid (j->pid, &status, kill_it ? 0 : WNOHANG)) && errno == EINTR) {}
+    if (!r)
+	return false;
+    if (r < 0)
+	j->status = kill_it ? 128 + SIGKILL : 0;
+    else if (WIFSIGNALED (status))
+	j->status = 128 + WTERMSIG (status);
+    else
+	j->status = WIFEXITED (status) ? WEXITSTATUS (status) : 0;
+    return true;
+}
+
+static void FreeExecJob (struct execjob* j)
+{
+    if (j->fd >= 0)
+	close (j->fd);
+    RxBufRelease (&j->data, &j->capacity);
+    free (j);
+}
+
+// Moves the script output into the feed, or records the error
+static void FinishExecJob (struct execjob* j, bool timedout)
+{
+    struct feed* fp = j->feed;
+    void (*done)(struct feed*) = j->done;
+    uint32_t total = ExecJobTime (j);
+    int status = j->status;
+
+    struct fetchstat* s = AddFeedFetchStat (fp);
+    s->time = time (NULL);
+    s->starttransfer = j->firstoutput;
+    s->total = total;
+    s->bytes = s->decoded = j->size;
+    s->httpcode = status;
+    fp->downloadtime = total / 1000;
+
+    free (fp->lasterror);
+    fp->lasterror = NULL;
+    if (!timedout && j->size) {
+	fp->problem = false;
+	RxBufRelease (&fp->xmltext, &fp->xmlcapacity);
+	j->data[j->size] = '\0';
+	fp->xmltext = j->data;
+	fp->xmlcapacity = j->capacity;
+	fp->content_length = j->size;
+	j->data = NULL;
+	j->capacity = 0;
+    } else {
+	// On error, keep the original text
+	fp->problem = true;
+	char msgbuf [64];
+	if (timedout)
+	    snprintf (msgbuf, sizeof(msgbuf), _("Script timed out after %u seconds"), _settings.feedtimeout);
+	else
+	    snprintf (msgbuf, sizeof(msgbuf), _("Script produced no output, exit status %d"), status);
+	fp->lasterror = strdup (msgbuf);
+	syslog (LOG_ERR, "%s: %s", ExecCommand (fp), msgbuf);
+    }
+    FreeExecJob (j);
+    if (done)
+	done (fp);
+}
+
+// Starts queued scripts while there are free slots
+static void StartQueuedExecJobs (void)
+{
+    while (s_exec_queue && s_exec_nactive < ExecPoolSize()) {
+	struct execjob* j = s_exec_queue;
+	if (!(s_exec_queue = j->next))
+	    s_exec_queue_last = NULL;
+	j->next = NULL;
+	--s_exec_nqueued;
+	if (StartExecJob (j)) {
+	    j->next = s_exec_active;
+	    s_exec_active = j;
+	    ++s_exec_nactive;
+	} else {
+	    struct feed* fp = j->feed;
+	    void (*done)(struct feed*) = j->done;
+	    fp->problem = true;
+	    free (fp->lasterror);
+	    fp->lasterror = strdup (strerror (errno));
+	    syslog (LOG_ERR, "%s: %s", ExecCommand (fp), fp->lasterror);
+	    FreeExecJob (j);
+	    if (done)
+		done (fp);
+	}
+    }
+}
+
+// Starts running the exec feed script of fp in the background. When
+// finished, the output is stored in fp->xmltext and done is called.
+bool QueueExecFeed (struct feed* fp, void (*done)(struct feed* fp))
+{
+    struct execjob* j = calloc (1, sizeof (struct execjob));
+    if (!j)
+	return false;
+    j->feed = fp;
+    j->done = done;
+    j->fd = -1;
+    j->status = -1;
+    if (s_exec_queue_last)
+	s_exec_queue_last->next = j;
+    else
+	s_exec_queue = j;
+    s_exec_queue_last = j;
+    ++s_exec_nqueued;
+    StartQueuedExecJobs();
+    return true;
+}
+
+// Number of queued or running exec feeds
+unsigned PendingExecFeeds (void)
+{
+    return s_exec_nqueued + s_exec_nactive;
+}
+
+// Returns true if the script of fp is running or waits to be
+bool ExecFeedPending (const struct feed* fp)
+{
+    for (const struct execjob* j = s_exec_active; j; j = j->next)
+	if (j->feed == fp)
+	    return true;
+    for (const struct execjob* j = s_exec_queue; j; j = j->next)
+	if (j->feed == fp)
+	    return true;
+    return false;
+}
+
+// Removes j from the singly linked list at *pl
+static void UnlinkExecJob (struct execjob** pl, const struct execjob* j)
+{
+    for (; *pl; pl = &(*pl)->next) {
+	if (*pl == j) {
+	    *pl = j->next;
+	    return;
+	}
+    }
+}
+
+// Kills the scripts of fp, or all scripts if fp is NULL, without
+// calling the completion callback. Returns the number cancelled.
+static unsigned CancelExecJobs (const struct feed* fp)
+{
+    unsigned n = 0;
+    for (struct execjob* j = s_exec_active, *next; j; j = next) {
+	next = j->next;
+	if (fp && j->feed != fp)
+	    continue;
+	UnlinkExecJob (&s_exec_active, j);
+	--s_exec_nactive;
+	ReapExecJob (j, true);
+	FreeExecJob (j);
+	++n;
+    }
+    for (struct execjob* j = s_exec_queue, *prev = NULL, *next; j; j = next) {
+	next = j->next;
+	if (fp && j->feed != fp) {
+	    prev = j;
+	    continue;
+	}
+	UnlinkExecJob (&s_exec_queue, j);
+	if (s_exec_queue_last == j)
+	    s_exec_queue_last = prev;
+	--s_exec_nqueued;
+	FreeExecJob (j);
+	++n;
+    }
+    StartQueuedExecJobs();
+    return n;
+}
+
+// Must be called before fp is freed
+void CancelExecFeed (const struct feed* fp)
+{
+    CancelExecJobs (fp);
+}
+
+unsigned CancelAllExecFeeds (void)
 {
-    char* command = strdup (cur_ptr->feedurl);
-    char* freeme = command;
+    return CancelExecJobs (NULL);
+}
+
+// Fills fds with the outputs of the running scripts, and lowers
+// timeout, in milliseconds, to when the first of them times out.
+// Scripts that closed their output, but have not exited yet, are
+// checked again after EXEC_REAP_INTERVAL. Returns the number of fds filled.
+unsigned ExecFeedPollFds (struct pollfd* fds, unsigned maxfds, unsigned* timeout)
+{
+    unsigned n = 0;
+    for (const struct execjob* j = s_exec_active; j; j = j->next) {
+	if (j->fd >= 0 && n < maxfds)
+	    fds[n++] = (struct pollfd) { .fd = j->fd, .events = POLLIN };
+	unsigned left = ExecJobTimeLeft (j);
+	if (j->fd < 0 && left > EXEC_REAP_INTERVAL)
+	    left = EXEC_REAP_INTERVAL;
+	if (left < *timeout)
+	    *timeout = left;
+    }
+    return n;
+}
 
-    strsep (&command, ":");
+// Reads the output of the running scripts, finishing those done
+// or timed out, and starts the queued ones in their place.
+void ProcessExecFeeds (void)
+{
+    for (struct execjob* j = s_exec_active; j;) {
+	if (j->fd >= 0 && ReadExecJob (j)) {
+	    close (j->fd);
+	    j->fd = -1;
+	}
+	// The exit status is collected after the end of the output
+	bool timedout = !ExecJobTimeLeft (j);
+	if (!(j->fd < 0 && ReapExecJob (j, false))) {
+	    if (!timedout) {
+		j = j->next;
+		continue;
+	    }
+	    ReapExecJob (j, true);
+	}
+	UnlinkExecJob (&s_exec_active, j);
+	--s_exec_nactive;
+	// A script that lingers after writing all its output keeps it
+	FinishExecJob (j, timedout && j->fd >= 0);
+	// The callback may have changed the list
+	j = s_exec_active;
+    }
+    StartQueuedExecJobs();
+}
 
+// Loads the output of the exec feed script, waiting until done.
+// Must be valid RSS.
+int FilterExecURL (struct feed* cur_ptr)
+{
     char buf[BUFSIZ];
-    snprintf (buf, sizeof (buf), _("Loading \"%s\""), command);
+    snprintf (buf, sizeof (buf), _("Loading \"%s\""), ExecCommand (cur_ptr));
     UIStatus (buf, 0, 0);
 
-    FILE* scriptoutput = popen (command, "r");
-    free (freeme);
-    if (!scriptoutput)
+    if (!QueueExecFeed (cur_ptr, NULL))
 	return -1;
-
-    cur_ptr->content_length = 0;
-    cur_ptr->xmltext = realloc (cur_ptr->xmltext, cur_ptr->content_length + 1);
-    cur_ptr->xmltext[cur_ptr->content_length] = '\0';
-
-    while (!feof (scriptoutput) && fgets (buf, sizeof (buf), scriptoutput)) {
-	size_t br = strlen (buf);
-	cur_ptr->xmltext = realloc (cur_ptr->xmltext, cur_ptr->content_length + br + 1);
-	memcpy (&cur_ptr->xmltext[cur_ptr->content_length], buf, br + 1);
-	cur_ptr->content_length += br;
+    while (ExecFeedPending (cur_ptr)) {
+	struct pollfd fds [EXEC_POOL_SIZE];
+	unsigned timeout = 1000;
+	unsigned nfds = ExecFeedPollFds (fds, EXEC_POOL_SIZE, &timeout);
+	poll (fds, nfds, timeout);
+	ProcessExecFeeds();
     }
-    pclose (scriptoutput);
+    if (cur_ptr->lasterror)
+	UIStatus (cur_ptr->lasterror, 2, 1);
 
     // Set title and link structure to something.
     // To the feedurl in this case so the program shows something
@@ -60,128 +475,493 @@ int FilterExecURL (struct feed* cur_ptr)
 	cur_ptr->title = strdup (cur_ptr->feedurl);
     if (cur_ptr->link == NULL)
 	cur_ptr->link = strdup (cur_ptr->feedurl);
-    return 0;
+    return cur_ptr->problem ? -1 : 0;
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Filters ----------------------------------------------------------
+//
+// A filter gets the downloaded feed on stdin and writes the converted
+// feed to stdout. A filter prefixed with "coproc:" is kept running and
+// reused for every feed, exchanging documents as frames, each a line
+// with the decimal length in bytes followed by that many bytes. A filter
+// prefixed with "plugin:" is a shared object called in-process.
+
+#define COPROC_PREFIX	"coproc:"
+#define PLUGIN_PREFIX	"plugin:"
+
+static void FilterFailed (struct feed* cur_ptr, const char* command)
+{
+    cur_ptr->problem = true;
+    char msgbuf [128];
+    snprintf (msgbuf, sizeof(msgbuf), _("Filter \"%s\" failed"), command);
+    free (cur_ptr->lasterror);
+    cur_ptr->lasterror = strdup (msgbuf);
 }
 
 int FilterPipeNG (struct feed* cur_ptr)
 {
-    if (cur_ptr->perfeedfilter == NULL)
+    if (cur_ptr->perfeedfilter == NULL || cur_ptr->xmltext == NULL)
 	return -1;
 
-    char* data = malloc (cur_ptr->content_length + 1);
-    memcpy (data, cur_ptr->xmltext, cur_ptr->content_length);
-    data[cur_ptr->content_length] = 0;
-
-    free (cur_ptr->xmltext);
+    // The downloaded text is the filter input, replaced by its output
+    char* data = cur_ptr->xmltext;
+    unsigned data_size = cur_ptr->content_length, data_capacity = cur_ptr->xmlcapacity;
     cur_ptr->xmltext = NULL;
+    cur_ptr->xmlcapacity = 0;
     cur_ptr->content_length = 0;
 
-    char* filter = strdup (cur_ptr->perfeedfilter);
-    char* command = strsep (&filter, " ");
-
-    char** options = malloc (sizeof (char*));
-    size_t nopts = 0;
-    options[nopts++] = command;
+    const char* cmdline = cur_ptr->perfeedfilter;
+    if (!strncmp (cmdline, PLUGIN_PREFIX, strlen (PLUGIN_PREFIX))) {
+	const char* path = cmdline + strlen (PLUGIN_PREFIX);
+	int rc = plugin_filter_buf (path, data, data_size,
+			       &cur_ptr->xmltext, &cur_ptr->content_length, &cur_ptr->xmlcapacity);
+	if (rc < 0)
+	    FilterFailed (cur_ptr, path);
+	RxBufRelease (&data, &data_capacity);
+	return rc;
+    }
+    bool coproc = !strncmp (cmdline, COPROC_PREFIX, strlen (COPROC_PREFIX));
+    if (coproc)
+	cmdline += strlen (COPROC_PREFIX);
 
-    for (;;) {
-	options = realloc (options, sizeof (char*) * (nopts + 1));
-	if (!(options[nopts++] = strsep (&filter, " ")))
-	    break;
+    char* filter = strdup (cmdline);
+    char** options = filter ? split_args (filter) : NULL;
+    if (!options || !options[0]) {
+	FilterFailed (cur_ptr, cmdline);
+	RxBufRelease (&data, &data_capacity);
+	free (options);
+	free (filter);
+	return -1;
     }
+    const char* command = options[0];
 
-    int rc = pipe_command_buf (command, options,
-			       data, cur_ptr->content_length,
-			       &cur_ptr->xmltext, &cur_ptr->content_length);
+    int rc = (coproc ? coproc_command_buf : pipe_command_buf) (coproc ? cmdline : command, options,
+			       data, data_size,
+			       &cur_ptr->xmltext, &cur_ptr->content_length, &cur_ptr->xmlcapacity);
+    if (rc < 0)
+	FilterFailed (cur_ptr, command);
 
-    free (data);
-    free (command);
+    RxBufRelease (&data, &data_capacity);
+    free (filter);
     free (options);	       // options[i] contains only pointers!
     return rc;
 }
 
-static int pipe_command_buf (const char* command, char** argv, const void* inbuf, size_t inbuf_size, char** outbuf, unsigned* outbuf_size)
+// Starts the filter with pipes to its stdin and from its stdout.
+// Both are nonblocking, to be pumped together. Returns the pid.
+static pid_t spawn_filter (const char* command, char** argv, int* tofd, int* fromfd)
 {
     enum { READ_END, WRITE_END, N_ENDS };
 
+    // Close on exec, so not inherited by other children, which would
+    // keep a co-process from seeing the end of its input
     int input_pipe[N_ENDS], output_pipe[N_ENDS];
-    if (0 != pipe (input_pipe)) {
+    if (0 != pipe2 (input_pipe, O_CLOEXEC)) {
 	perror ("Couldn't create input pipe");
 	return -1;
     }
-    if (0 != pipe (output_pipe)) {
+    if (0 != pipe2 (output_pipe, O_CLOEXEC)) {
 	close (input_pipe[READ_END]);
 	close (input_pipe[WRITE_END]);
 	perror ("Couldn't create output pipe");
 	return -1;
     }
 
-    int result = fork();
-    if (result < 0) {
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init (&fa);
+    posix_spawn_file_actions_adddup2 (&fa, output_pipe[READ_END], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2 (&fa, input_pipe[WRITE_END], STDOUT_FILENO);
+    posix_spawnattr_t attr;
+    spawn_attr_init (&attr, false);
+    pid_t pid;
+    int err = posix_spawnp (&pid, command, &fa, &attr, argv, environ);
+    posix_spawnattr_destroy (&attr);
+    posix_spawn_file_actions_destroy (&fa);
+    close (output_pipe[READ_END]);
+    close (input_pipe[WRITE_END]);
+    if (err) {
 	close (input_pipe[READ_END]);
-	close (input_pipe[WRITE_END]);
-	close (output_pipe[READ_END]);
 	close (output_pipe[WRITE_END]);
-	perror ("fork");
+	char msgbuf [PATH_MAX];
+	snprintf (msgbuf, sizeof (msgbuf), _("Exec of \"%s\" failed: %s"), command, strerror (err));
+	UIStatus (msgbuf, 2, 1);
+	syslog (LOG_ERR, "%s", msgbuf);
 	return -1;
-    } else if (result == 0) {
-	close (output_pipe[WRITE_END]);
-	close (input_pipe[READ_END]);
+    }
 
-	if (0 > dup2 (output_pipe[READ_END], STDIN_FILENO)) {
-	    perror ("dup2 error on output_pipe");
-	    exit (EXIT_FAILURE);
-	}
-	close (output_pipe[READ_END]);
+    *tofd = output_pipe[WRITE_END];
+    *fromfd = input_pipe[READ_END];
+    fcntl (*tofd, F_SETFL, O_NONBLOCK);
+    fcntl (*fromfd, F_SETFL, O_NONBLOCK);
+    return pid;
+}
 
-	if (0 > dup2 (input_pipe[WRITE_END], STDOUT_FILENO)) {
-	    perror ("dup2 error on input_pipe");
-	    exit (EXIT_FAILURE);
-	}
-	close (input_pipe[WRITE_END]);
+// Writes filter input to the pipe. On Linux, vmsplice maps the pages
+// into the pipe instead of copying them into the pipe buffer.
+static ssize_t pipe_write (int fd, const struct iovec* iov, unsigned niov)
+{
+#ifdef __linux__
+    static bool no_vmsplice = false;
+    if (!no_vmsplice) {
+	ssize_t bw = vmsplice (fd, iov, niov, SPLICE_F_NONBLOCK);
+	if (bw >= 0 || (errno != EINVAL && errno != ENOSYS))
+	    return bw;
+	no_vmsplice = true;
+    }
+#endif
+    return writev (fd, iov, niov);
+}
 
-	if (0 > execvp (command, argv)) {
-	    char tmp[PATH_MAX];
-	    snprintf (tmp, sizeof (tmp), "Exec of \"%s\" failed", command);
-	    perror (tmp);
-	}
-	exit (EXIT_FAILURE);
-    } else {
-	close (output_pipe[READ_END]);
-	close (input_pipe[WRITE_END]);
+// Moves the iovec array past n written bytes
+static void iov_advance (struct iovec** iov, unsigned* niov, size_t n)
+{
+    for (; *niov && n >= (*iov)->iov_len; ++*iov, --*niov)
+	n -= (*iov)->iov_len;
+    if (*niov) {
+	(*iov)->iov_base = (char*) (*iov)->iov_base + n;
+	(*iov)->iov_len -= n;
+    }
+}
 
-	write (output_pipe[WRITE_END], inbuf, inbuf_size);
-	close (output_pipe[WRITE_END]);
+// Reads all the filter output available into buf, growing it as needed.
+// Returns 1 at the end of the output, 0 when it would block, -1 on error.
+static int pipe_read (int fd, char** buf, unsigned* buf_size, unsigned* buf_capacity)
+{
+    for (;;) {
+	if (!RxBufReserve (buf, buf_capacity, *buf_size, *buf_size + BUFSIZ + 1))
+	    return -1;
+	ssize_t br = read (fd, &(*buf)[*buf_size], *buf_capacity - *buf_size - 1);
+	if (br > 0)
+	    *buf_size += br;
+	else if (br == 0)
+	    return 1;
+	else if (errno == EAGAIN)
+	    return 0;
+	else if (errno != EINTR)
+	    return -1;
+    }
+}
+
+// Checks for a whole frame in buf. Returns 1 and sets the header size
+// and the document size if there is one, 0 if more is needed, and -1
+// if buf does not hold a single frame.
+static int frame_status (const char* buf, unsigned size, unsigned* header_size, size_t* doc_size)
+{
+    unsigned i = 0;
+    size_t n = 0;
+    for (; i < size && i < 12 && buf[i] >= '0' && buf[i] <= '9'; ++i)
+	n = n * 10 + buf[i] - '0';
+    if (i >= size)
+	return 0;
+    if (!i || buf[i] != '\n')
+	return -1;
+    *header_size = i + 1;
+    *doc_size = n;
+    if (size < *header_size + n)
+	return 0;
+    return size == *header_size + n ? 1 : -1;
+}
 
-	char* buf = NULL, *buf_cur = NULL;
-	int buf_size = 0, bytes_read = 0;
-	do {
-	    buf_size += BUFSIZ;
-	    buf = realloc (buf, buf_size + 1);
-	    buf_cur = buf + buf_size - BUFSIZ;
-	    result = read (input_pipe[READ_END], buf_cur, BUFSIZ);
-	    if (result > 0) {
-		bytes_read += result;
-		if (result < BUFSIZ) {
-		    buf_size -= (BUFSIZ - result);
-		    buf = realloc (buf, buf_size + 1);
-		    break;
+// Writes the input to the filter while reading its output, so a filter
+// writing before it has read all its input does not block on a full
+// pipe. Reads until the end of the output; with framed, until a whole
+// frame arrived, leaving *tofd open for the next one. Otherwise *tofd
+// is closed after the input, and set to -1. Returns 0 when done, -1
+// on error, and -2 if the filter ran longer than the feed timeout.
+static int pump_filter (int* tofd, int fromfd, struct iovec* iov, unsigned niov, bool framed, char** buf, unsigned* buf_size, unsigned* buf_capacity)
+{
+    struct timespec start;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    iov_advance (&iov, &niov, 0);
+    int wfd = niov ? *tofd : -1;
+    if (!framed && wfd < 0) {
+	close (*tofd);
+	*tofd = -1;
+    }
+    for (;;) {
+	int timeout = -1;
+	if (_settings.feedtimeout) {
+	    struct timespec now;
+	    clock_gettime (CLOCK_MONOTONIC, &now);
+	    int64_t left = _settings.feedtimeout * 1000ll - (now.tv_sec - start.tv_sec) * 1000 - (now.tv_nsec - start.tv_nsec) / 1000000;
+	    if (left <= 0)
+		return -2;
+	    timeout = left;
+	}
+	// poll skips the filter input once written, at -1
+	struct pollfd fds [2] = {{ .fd = fromfd, .events = POLLIN }, { .fd = wfd, .events = POLLOUT }};
+	if (0 > poll (fds, 2, timeout)) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	if (fds[1].revents) {
+	    // A filter exiting early gets EPIPE; its output is still read
+	    ssize_t bw = pipe_write (wfd, iov, niov);
+	    if (bw > 0)
+		iov_advance (&iov, &niov, bw);
+	    if (!niov || (bw < 0 && errno != EAGAIN && errno != EINTR)) {
+		wfd = -1;
+		if (!framed) {
+		    close (*tofd);
+		    *tofd = -1;
 		}
-	    } else if (result < 0) {
-		free (buf);
-		buf = NULL;
-		return -1;
 	    }
-	} while (result > 0);
-	close (input_pipe[READ_END]);
+	}
+	if (fds[0].revents) {
+	    int rr = pipe_read (fromfd, buf, buf_size, buf_capacity);
+	    if (rr < 0 || (rr > 0 && framed))
+		return -1;
+	    else if (rr > 0)
+		return 0;
+	    // A reply before all the input was taken is out of step
+	    unsigned header_size;
+	    size_t doc_size;
+	    if (framed && *buf_size && (rr = frame_status (*buf, *buf_size, &header_size, &doc_size)))
+		return rr > 0 && wfd < 0 ? 0 : -1;
+	}
+    }
+}
 
-	if (bytes_read == 0) {
-	    free (buf);
-	    return -1;
-	} else {
-	    buf[buf_size] = '\0';
-	    *outbuf = buf;
-	    *outbuf_size = buf_size;
+// Kills a filter that ran too long, telling the user why
+static void filter_timed_out (pid_t pid, const char* command)
+{
+    kill (pid, SIGKILL);
+    char msgbuf [128];
+    snprintf (msgbuf, sizeof(msgbuf), _("Filter \"%s\" timed out after %u seconds"), command, _settings.feedtimeout);
+    UIStatus (msgbuf, 2, 1);
+    syslog (LOG_ERR, "%s", msgbuf);
+}
+
+// Waits for a filter that was killed or has closed its pipes to exit,
+// so it does not linger as a zombie. The UI's SIGCHLD handler may have
+// reaped it already.
+static void reap_filter (pid_t pid)
+{
+    while (0 > waitpid (pid, NULL, 0) && errno == EINTR) {}
+}
+
+// Pipes inbuf through command, collecting its output in outbuf.
+// The filter is killed if it runs longer than the feed timeout.
+static int pipe_command_buf (const char* command, char** argv, const void* inbuf, size_t inbuf_size, char** outbuf, unsigned* outbuf_size, unsigned* outbuf_capacity)
+{
+    int tofd, fromfd;
+    pid_t pid = spawn_filter (command, argv, &tofd, &fromfd);
+    if (pid < 0)
+	return -1;
+
+    char* buf = NULL;
+    unsigned buf_size = 0, buf_capacity = 0;
+    // Filters usually output about as much as they get
+    RxBufReserve (&buf, &buf_capacity, 0, inbuf_size + 1);
+    struct iovec iov = { .iov_base = (void*) inbuf, .iov_len = inbuf_size };
+    int result = pump_filter (&tofd, fromfd, &iov, 1, false, &buf, &buf_size, &buf_capacity);
+    if (tofd >= 0)
+	close (tofd);
+    close (fromfd);
+    if (result == -2)
+	filter_timed_out (pid, command);
+    reap_filter (pid);
+
+    if (result < 0 || buf_size == 0) {
+	RxBufRelease (&buf, &buf_capacity);
+	return -1;
+    }
+    buf[buf_size] = '\0';
+    *outbuf = buf;
+    *outbuf_size = buf_size;
+    *outbuf_capacity = buf_capacity;
+    return 0;
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Filter co-processes
+
+struct coproc {
+    struct coproc*	next;
+    char*		cmdline;	// Filter command with its arguments
+    pid_t		pid;
+    int			tofd;
+    int			fromfd;
+};
+
+static struct coproc* s_coprocs = NULL;
+
+static void stop_coproc (struct coproc* cp)
+{
+    for (struct coproc** pl = &s_coprocs; *pl; pl = &(*pl)->next) {
+	if (*pl == cp) {
+	    *pl = cp->next;
+	    break;
 	}
     }
+    // The end of its input tells the co-process to exit
+    close (cp->tofd);
+    close (cp->fromfd);
+    kill (cp->pid, SIGTERM);
+    reap_filter (cp->pid);
+    free (cp->cmdline);
+    free (cp);
+}
+
+static void stop_all_coprocs (void)
+{
+    while (s_coprocs)
+	stop_coproc (s_coprocs);
+}
+
+static struct coproc* start_coproc (const char* cmdline, char** argv)
+{
+    struct coproc* cp = calloc (1, sizeof (struct coproc));
+    if (!cp)
+	return NULL;
+    if (0 > (cp->pid = spawn_filter (argv[0], argv, &cp->tofd, &cp->fromfd))) {
+	free (cp);
+	return NULL;
+    }
+    cp->cmdline = strdup (cmdline);
+    if (!s_coprocs)
+	atexit (stop_all_coprocs);
+    cp->next = s_coprocs;
+    s_coprocs = cp;
+    return cp;
+}
+
+// Sends inbuf to the co-process running cmdline, starting it if needed,
+// and reads the filtered document into outbuf. A co-process that fails
+// is stopped; if it was started earlier and may have died since, it is
+// restarted and given the document again.
+static int coproc_command_buf (const char* cmdline, char** argv, const void* inbuf, size_t inbuf_size, char** outbuf, unsigned* outbuf_size, unsigned* outbuf_capacity)
+{
+    struct coproc* cp = s_coprocs;
+    while (cp && strcmp (cp->cmdline, cmdline))
+	cp = cp->next;
+    bool restarted = false;
+    if (!cp) {
+	if (!(cp = start_coproc (cmdline, argv)))
+	    return -1;
+	restarted = true;
+    }
+
+    char header [24];
+    struct iovec iov[2] = {
+	{ .iov_base = header, .iov_len = snprintf (header, sizeof(header), "%zu\n", inbuf_size) },
+	{ .iov_base = (void*) inbuf, .iov_len = inbuf_size }
+    };
+    char* buf = NULL;
+    unsigned buf_size = 0, buf_capacity = 0;
+    RxBufReserve (&buf, &buf_capacity, 0, inbuf_size + sizeof(header) + 1);
+    int result = pump_filter (&cp->tofd, cp->fromfd, iov, 2, true, &buf, &buf_size, &buf_capacity);
+    if (result < 0) {
+	RxBufRelease (&buf, &buf_capacity);
+	if (result == -2)
+	    filter_timed_out (cp->pid, argv[0]);
+	stop_coproc (cp);
+	if (result == -1 && !restarted)
+	    return coproc_command_buf (cmdline, argv, inbuf, inbuf_size, outbuf, outbuf_size, outbuf_capacity);
+	return -1;
+    }
+
+    unsigned header_size = 0;
+    size_t doc_size = 0;
+    frame_status (buf, buf_size, &header_size, &doc_size);
+    if (!doc_size) {
+	RxBufRelease (&buf, &buf_capacity);
+	return -1;
+    }
+    memmove (buf, &buf[header_size], doc_size);
+    buf[doc_size] = '\0';
+    *outbuf = buf;
+    *outbuf_size = doc_size;
+    *outbuf_capacity = buf_capacity;
     return 0;
 }
+
+//}}}-------------------------------------------------------------------
+//{{{ Filter plugins
+
+struct plugin {
+    struct plugin*		next;
+    char*			path;
+    void*			handle;
+    snownews_filter_transform_t	transform;
+};
+
+// Loaded plugins stay loaded, since they are used on every refresh
+static struct plugin* s_plugins = NULL;
+
+static const struct plugin* load_plugin (const char* path)
+{
+    for (const struct plugin* pl = s_plugins; pl; pl = pl->next)
+	if (!strcmp (pl->path, path))
+	    return pl;
+
+    void* handle = dlopen (path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+	const char* err = dlerror();
+	UIStatus (err, 2, 1);
+	syslog (LOG_ERR, "%s", err);
+	return NULL;
+    }
+    const unsigned* abi = dlsym (handle, "snownews_filter_abi");
+    snownews_filter_transform_t transform = NULL;
+    *(void**) &transform = dlsym (handle, "snownews_filter_transform");
+    if (!abi || *abi != SNOWNEWS_FILTER_ABI || !transform) {
+	char msgbuf [128];
+	snprintf (msgbuf, sizeof(msgbuf), _("\"%s\" is not a snownews filter plugin"), path);
+	UIStatus (msgbuf, 2, 1);
+	syslog (LOG_ERR, "%s", msgbuf);
+	dlclose (handle);
+	return NULL;
+    }
+    struct plugin* pl = calloc (1, sizeof (struct plugin));
+    if (!pl) {
+	dlclose (handle);
+	return NULL;
+    }
+    pl->path = strdup (path);
+    pl->handle = handle;
+    pl->transform = transform;
+    pl->next = s_plugins;
+    s_plugins = pl;
+    return pl;
+}
+
+// The output buffer given to plugins, kept as a receive buffer
+struct plugin_out {
+    struct snownews_filter_out	out;
+    unsigned			capacity;
+};
+
+static char* plugin_out_reserve (struct snownews_filter_out* out, size_t n)
+{
+    struct plugin_out* po = (struct plugin_out*) out;
+    // One more for the terminating zero
+    if (out->size + n >= UINT_MAX || !RxBufReserve (&out->data, &po->capacity, out->size, out->size + n + 1))
+	return NULL;
+    return &out->data[out->size];
+}
+
+// Converts inbuf with the plugin at path, loading it if needed
+static int plugin_filter_buf (const char* path, const char* inbuf, size_t inbuf_size, char** outbuf, unsigned* outbuf_size, unsigned* outbuf_capacity)
+{
+    const struct plugin* pl = load_plugin (path);
+    if (!pl)
+	return -1;
+    struct plugin_out po = { .out = { .reserve = plugin_out_reserve } };
+    // Filters usually output about as much as they get
+    RxBufReserve (&po.out.data, &po.capacity, 0, inbuf_size + 1);
+    int rc = pl->transform (inbuf, inbuf_size, &po.out);
+    if (rc || !po.out.size || po.out.size >= po.capacity) {
+	RxBufRelease (&po.out.data, &po.capacity);
+	return -1;
+    }
+    po.out.data[po.out.size] = '\0';
+    *outbuf = po.out.data;
+    *outbuf_size = po.out.size;
+    *outbuf_capacity = po.capacity;
+    return 0;
+}
+
+//}}}-------------------------------------------------------------------
@@ -16,6 +16,16 @@
 
 #pragma once
 #include "main.h"
+#include <poll.h>
+
+enum { EXEC_POOL_SIZE = 8 };	// Most exec feeds run at once
 
 int FilterExecURL (struct feed* cur_ptr);
+bool QueueExecFeed (struct feed* fp, void (*done)(struct feed* fp));
+unsigned PendingExecFeeds (void);
+bool ExecFeedPending (const struct feed* fp);
+void CancelExecFeed (const struct feed* fp);
+unsigned CancelAllExecFeeds (void);
+unsigned ExecFeedPollFds (struct pollfd* fds, unsigned maxfds, unsigned* timeout);
+void ProcessExecFeeds (void);
 int FilterPipeNG (struct feed* cur_ptr);
@@ -18,11 +18,14 @@
 #include "main.h"
 #include "ui.h"
 #include "feedio.h"
+#include "netio.h"
+#include "rxbuf.h"
 #include "setup.h"
 #include "uiutil.h"
 #include <ncurses.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 
 //{{{ Global variables -------------------------------------------------
 
@@ -41,6 +44,7 @@ struct settings _settings = {
 		    .about = 'A',
 		    .addfeed = 'a',
 		    .andxor = 'X',
+		    .cancelrefresh = 'x',
 		    .categorize = 'C',
 		    .changefeedname = 'c',
 		    .deletefeed = 'D',
@@ -82,6 +86,9 @@ struct settings _settings = {
 	      .newitemsbold = 0,
 	      .urljump = 4,
 	      .urljumpbold = 0 },
+    .maxdownloads = 8,
+    .hostconnections = 2,
+    .feedtimeout = 120
 };
 
 //----------------------------------------------------------------------
@@ -136,7 +143,9 @@ static void checkPIDFile (void)
 	printf ("Snownews seems to be already running with process ID %d.\n", pid);
 	printf ("A pid file exists at \"%s\".\n", pid_path);
 	exit (2);
-    } else {
+    } else if (_settings.headless)
+	modifyPIDFile (pid_file_delete);	// Stale, and there is nobody to ask
+    else {
 	printf ("A pid file exists at \"%s\",\nbut Snownews doesn't seem to be running. Delete that file and start it again.\n", pid_path);
 	printf ("Continue anyway? (y/n) ");
 	char ybuf[2] = { };
@@ -194,7 +203,8 @@ _Noreturn void MainQuit (const char* func, const char* error)
 {
     if (!error)		       // Only save settings if we didn't exit on error.
 	WriteCache();
-    endwin();		       // Make sure no ncurses function is called after this point!
+    if (!_settings.headless)
+	endwin();	       // Make sure no ncurses function is called after this point!
     modifyPIDFile (pid_file_delete);
 
     if (!error)
@@ -231,8 +241,12 @@ static _Noreturn void MainSignalHandler (int sig)
 // Automatic child reaper.
 static void sigChildHandler (int sig __attribute__((unused)))
 {
-    // Wait for any child without blocking
-    waitpid (-1, NULL, WNOHANG);
+    // Wait for children in the process group of snownews without
+    // blocking. Exec feed scripts have groups of their own, and are
+    // reaped by the exec pool to get their exit status.
+    int saved_errno = errno;
+    while (0 < waitpid (0, NULL, WNOHANG)) {}
+    errno = saved_errno;
 }
 
 static void InstallSignalHandlers (void)
@@ -258,10 +272,13 @@ static void InstallSignalHandlers (void)
 static void printHelp (void)
 {
     printf (_("Snownews %s\n\n"), SNOWNEWS_VERSTRING);
-    printf (_("usage: snownews [-huV] [--help|--update|--version]\n\n"));
+    printf (_("usage: snownews [-dhrtuV] [--help|--update|--refresh-only|--daemon|--timings|--version]\n\n"));
     printf (_("\t--charset|-l\tForce using this charset.\n"));
     printf (_("\t--cursor-on|-c\tForce cursor always visible.\n"));
+    printf (_("\t--daemon|-d\tRefresh feeds when due, without the UI.\n"));
     printf (_("\t--help|-h\tPrint this help message.\n"));
+    printf (_("\t--refresh-only|-r\tRefresh due feeds without the UI and exit.\n"));
+    printf (_("\t--timings|-t\tPrint recent download timings of each feed and exit.\n"));
     printf (_("\t--update|-u\tAutomatically update every feed.\n"));
     printf (_("\t--version|-V\tPrint version number and exit.\n"));
 }
@@ -292,6 +309,160 @@ static void srandrand (void)
     srand (seed);
 }
 
+//}}}-------------------------------------------------------------------
+//{{{ Headless refresh
+//
+// --refresh-only and --daemon refresh the feed cache without the UI,
+// printing a tab separated line for each feed refreshed and a summary.
+
+static unsigned s_refresh_results [refresh_invalid + 1] = {};
+static unsigned* s_refresh_times = NULL;	// Download time of each feed, in ms
+static unsigned s_nrefresh_times = 0;
+static unsigned s_refresh_times_cap = 0;
+
+// Returns a copy of url without authinfo, for printing
+static char* PrintableUrl (const char* feedurl)
+{
+    char* url = strdup (feedurl);
+    char* pauthinfo = strchr (url, '@');
+    char* pserver = strstr (url, "://");
+    if (pauthinfo && pserver && pserver < pauthinfo)
+	memmove (pserver + 3, pauthinfo + 1, strlen (pauthinfo));
+    return url;
+}
+
+static void PrintRefreshResult (struct feed* fp, enum ERefreshResult result)
+{
+    static const char c_result_name[][12] = { "updated", "unchanged", "failed", "invalid" };
+    ++s_refresh_results[result];
+    if (s_nrefresh_times >= s_refresh_times_cap) {
+	unsigned newcap = s_refresh_times_cap ? 2 * s_refresh_times_cap : 64;
+	unsigned* newtimes = realloc (s_refresh_times, newcap * sizeof (unsigned));
+	if (newtimes) {
+	    s_refresh_times = newtimes;
+	    s_refresh_times_cap = newcap;
+	}
+    }
+    if (s_nrefresh_times < s_refresh_times_cap)
+	s_refresh_times[s_nrefresh_times++] = fp->downloadtime;
+
+    char* url = PrintableUrl (fp->feedurl);
+
+    unsigned nitems = 0;
+    for (const struct newsitem* i = fp->items; i; i = i->next)
+	++nitems;
+    printf ("%s\t%s\t%u\t%u\t%s\n", url, c_result_name[result], fp->downloadtime, nitems,
+	    result >= refresh_failed && fp->lasterror ? fp->lasterror : "");
+    free (url);
+}
+
+static int CompareUnsigned (const void* a, const void* b)
+{
+    unsigned x = *(const unsigned*) a, y = *(const unsigned*) b;
+    return x < y ? -1 : x > y;
+}
+
+// Returns the pct percentile of the sorted feed download times
+static unsigned RefreshTimePercentile (unsigned pct)
+{
+    if (!s_nrefresh_times)
+	return 0;
+    unsigned rank = (s_nrefresh_times * pct + 99) / 100;
+    return s_refresh_times[rank ? rank - 1 : 0];
+}
+
+// Refreshes all feeds, or only those due, and saves them.
+// Returns the number of feeds that failed to refresh.
+static unsigned RefreshCycle (bool all)
+{
+    memset (s_refresh_results, 0, sizeof (s_refresh_results));
+    s_nrefresh_times = 0;
+    RxBufResetStats();
+    struct timespec start, end;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+
+    puts ("# url\tresult\tms\titems\terror");
+    unsigned nskipped = all ? FeedsBackingOff (time (NULL)) : 0;
+    unsigned nrefreshed = RefreshFeeds (all, PrintRefreshResult);
+    WriteCache();
+
+    clock_gettime (CLOCK_MONOTONIC, &end);
+    unsigned ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    unsigned nfailed = s_refresh_results[refresh_failed] + s_refresh_results[refresh_invalid];
+    printf ("# refreshed=%u updated=%u unchanged=%u failed=%u skipped=%u ms=%u\n", nrefreshed,
+	    s_refresh_results[refresh_updated], s_refresh_results[refresh_unchanged], nfailed, nskipped, ms);
+
+    // Throughput and latency, to compare refresh performance between runs
+    if (s_nrefresh_times)
+	qsort (s_refresh_times, s_nrefresh_times, sizeof (unsigned), CompareUnsigned);
+    struct rusage usage = {};
+    getrusage (RUSAGE_SELF, &usage);
+    printf ("# feeds/s=%.1f p50_ms=%u p99_ms=%u max_ms=%u maxrss_kb=%ld\n",
+	    ms ? nrefreshed * 1000.0 / ms : 0.0, RefreshTimePercentile (50), RefreshTimePercentile (99),
+	    RefreshTimePercentile (100), usage.ru_maxrss);
+    const struct rxbuf_stats* bufstats = RxBufStats();
+    printf ("# buffers allocated=%u reused=%u grown=%u allocated_kb=%ju copied_kb=%ju\n",
+	    bufstats->allocs, bufstats->reuses, bufstats->grows,
+	    (uintmax_t) bufstats->allocated / 1024, (uintmax_t) bufstats->copied / 1024);
+    fflush (stdout);
+    return nfailed;
+}
+
+// Prints the recorded download history of every feed, oldest first,
+// with the cumulative transfer times reported by curl, in microseconds.
+static void PrintFetchStats (void)
+{
+    puts ("# url\ttime\thttp\tcurl\tredirects\tbytes\tdecoded_bytes\tnamelookup_us\tconnect_us\tappconnect_us\tstarttransfer_us\ttotal_us\tredirect_us");
+    for (const struct feed* f = _feed_list; f; f = f->next) {
+	char* url = PrintableUrl (f->feedurl);
+	for (unsigned age = FETCH_HISTORY_SIZE; age--;) {
+	    const struct fetchstat* s = FeedFetchStat (f, age);
+	    if (!s)
+		continue;
+	    char timebuf [32];
+	    strftime (timebuf, sizeof(timebuf), "%Y-%m-%dT%H:%M:%S", localtime (&s->time));
+	    printf ("%s\t%s\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\n", url, timebuf,
+		    s->httpcode, s->curlcode, s->redirects, s->bytes, s->decoded, s->namelookup, s->connect,
+		    s->appconnect, s->starttransfer, s->total, s->redirect);
+	}
+	free (url);
+    }
+}
+
+// Refreshes feeds as they become due until terminated by a signal
+static _Noreturn void RunDaemon (bool all)
+{
+    // Termination signals are only accepted between refreshes,
+    // so that the cache is never saved in the middle of one.
+    sigset_t quitsigs;
+    sigemptyset (&quitsigs);
+    sigaddset (&quitsigs, SIGHUP);
+    sigaddset (&quitsigs, SIGINT);
+    sigaddset (&quitsigs, SIGQUIT);
+    sigaddset (&quitsigs, SIGTERM);
+    sigprocmask (SIG_BLOCK, &quitsigs, NULL);
+
+    for (;;) {
+	RefreshCycle (all);
+	all = false;
+
+	// Sleep until the next feed is due, checking at least hourly
+	time_t now = time (NULL), next = now + 60*60;
+	for (const struct feed* f = _feed_list; f; f = f->next)
+	    if (!f->smartfeed && f->nextfetch < next)
+		next = f->nextfetch;
+	struct timespec wait = { .tv_sec = next > now ? next - now : 1 };
+	int sig;
+	do
+	    sig = sigtimedwait (&quitsigs, NULL, &wait);
+	while (sig < 0 && errno == EINTR);
+	if (sig > 0)
+	    break;
+    }
+    modifyPIDFile (pid_file_delete);
+    exit (EXIT_SUCCESS);
+}
+
 //}}}-------------------------------------------------------------------
 
 int main (int argc, char* argv[])
@@ -303,9 +474,10 @@ int main (int argc, char* argv[])
     bindtextdomain (SNOWNEWS_NAME, LOCALEPATH);
     textdomain (SNOWNEWS_NAME);
 #endif
-    RedirectStderrToLog();
 
     bool autoupdate = false;	// Automatically update feeds on app start... or not if set to 0.
+    bool daemon = false;	// Keep refreshing feeds without the UI
+    bool timings = false;	// Print download history and exit
     for (int i = 1; i < argc; ++i) {
 	char* arg = argv[i];
 	if (strcmp (arg, "--version") == 0 || strcmp (arg, "-V") == 0) {
@@ -313,6 +485,14 @@ int main (int argc, char* argv[])
 	    return EXIT_SUCCESS;
 	} else if (strcmp (arg, "-u") == 0 || strcmp (arg, "--update") == 0) {
 	    autoupdate = true;
+	} else if (strcmp (arg, "-r") == 0 || strcmp (arg, "--refresh-only") == 0) {
+	    _settings.headless = true;
+	} else if (strcmp (arg, "-d") == 0 || strcmp (arg, "--daemon") == 0) {
+	    _settings.headless = true;
+	    daemon = true;
+	} else if (strcmp (arg, "-t") == 0 || strcmp (arg, "--timings") == 0) {
+	    _settings.headless = true;
+	    timings = true;
 	} else if (strcmp (arg, "-c") == 0 || strcmp (arg, "--cursor-on") == 0) {
 	    _settings.cursor_always_visible = true;
 	} else if (strcmp (arg, "-l") == 0 || strcmp (arg, "--charset") == 0) {
@@ -333,10 +513,30 @@ int main (int argc, char* argv[])
 	}
     }
 
+    // Without the UI, errors are printed for the user to see
+    if (!_settings.headless)
+	RedirectStderrToLog();
+
+    // Only reads the cache, so may run alongside the UI or the daemon
+    if (timings) {
+	LoadAllFeeds (Config());
+	PrintFetchStats();
+	return EXIT_SUCCESS;
+    }
+
     // Create PID file.
     checkPIDFile();
     modifyPIDFile (pid_file_create);
 
+    if (_settings.headless) {
+	LoadAllFeeds (Config());
+	if (daemon)
+	    RunDaemon (autoupdate);
+	unsigned nfailed = RefreshCycle (autoupdate);
+	modifyPIDFile (pid_file_delete);
+	return nfailed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
     InitCurses();
 
     // Check if configfiles exist and create/read them.
@@ -19,8 +19,28 @@
 
 //----------------------------------------------------------------------
 
+enum { FETCH_HISTORY_SIZE = 8 };
+
+// Timing of one download. Times are in microseconds from the start
+// of the transfer, as reported by curl, so each includes the ones before.
+struct fetchstat {
+    time_t time;		// When the download finished
+    uint32_t namelookup;	// DNS resolved
+    uint32_t connect;		// TCP connected
+    uint32_t appconnect;	// TLS handshake done, 0 without TLS
+    uint32_t starttransfer;	// First response byte received
+    uint32_t total;		// Transfer complete
+    uint32_t redirect;		// Spent following redirects
+    uint32_t bytes;		// Body bytes received, compressed
+    uint32_t decoded;		// Body bytes after decompression
+    uint16_t httpcode;		// HTTP status, 0 if none; exit status of exec feeds
+    uint8_t curlcode;		// CURLcode of the transfer
+    uint8_t redirects;		// Redirects followed
+};
+
 struct feed {
     struct newsitem* items;
+    struct arena* itemarena;	// Owns items and their strings
     struct feed* next;
     struct feed* prev;
     char* feedurl;		// Non hashified URL
@@ -32,10 +52,22 @@ struct feed {
     char* custom_title;		// Custom feed title.
     char* original;		// Original feed title.
     char* perfeedfilter;	// Pipe feed through this program before parsing.
-    time_t mtime;		// Last local modification time
     time_t lastmodified;	// Last modification time on the server
+    char* etag;			// ETag of the last download, for If-None-Match
+    uint64_t digest;		// genContentHash of the last parsed download
+    time_t lastfetch;		// Time of the last successful download
+    unsigned downloadtime;	// Duration of the last download, in ms
+    time_t nextfetch;		// When the feed is due to be refreshed
+    time_t expires;		// Server cache expiration time
+    unsigned interval;		// Learned refresh interval, in seconds
+    unsigned ttl;		// Minimum refresh interval set by the feed
+    unsigned failures;		// Consecutive failed refreshes
+    unsigned nfetchstats;	// Downloads recorded in fetchstats
+    struct fetchstat fetchstats [FETCH_HISTORY_SIZE];	// Ring of the last downloads
     unsigned content_length;
+    unsigned xmlcapacity;	// Allocated size of xmltext, see rxbuf.h
     bool problem;		// Set if there was a problem downloading the feed.
+    bool cachedirty;		// Changed since the disk cache was read or written
     bool execurl;		// Execurl?
     bool smartfeed;		// 1: new items feed.
     struct feedcategories* feedcategories;
@@ -94,6 +126,7 @@ struct keybindings {
     char enter;
     char newheadlines;
     char typeahead;
+    char cancelrefresh;
 };
 
 // Color definitions
@@ -135,10 +168,17 @@ struct settings {
     char* browser;		// Browser command. lynx is standard.
     char* proxyname;		// Hostname of proxyserver.
     unsigned short proxyport;	// Port on proxyserver to use.
+    unsigned short maxdownloads;	// Number of feeds downloaded in parallel.
+    unsigned short hostconnections;	// Maximum connections to a single host.
+    unsigned maxrate;		// Total download rate limit in KB/s, 0 for none.
+    unsigned feedtimeout;	// Seconds one feed download may take, 0 for no limit.
+    unsigned refreshtimeout;	// Seconds a refresh of all feeds may take, 0 for no limit.
+    bool autorefresh;		// Refresh feeds in the UI when they are due.
     struct color color;
     struct keybindings keybindings;
     bool monochrome;
     bool cursor_always_visible;
+    bool headless;		// No terminal UI; --refresh-only and --daemon
 };
 
 //----------------------------------------------------------------------
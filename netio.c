@@ -18,118 +18,839 @@
 #include "netio.h"
 #include "uiutil.h"
 #include "setup.h"
+#include "conv.h"
+#include "rxbuf.h"
 #include <curl/curl.h>
+#include <ctype.h>
+#include <poll.h>
 
-static size_t FeedReceiver (void* buffer, size_t msz, size_t nm, void* vpfeed)
+//{{{ Transfer state ---------------------------------------------------
+
+// Consecutive failures of one server. After several, its feeds are
+// skipped for a cool-down period, which doubles each time the server
+// fails again when it is over.
+struct host_state {
+    struct host_state* next;
+    unsigned failures;		// Consecutive failed downloads
+    time_t retryafter;		// Downloads are skipped until then
+    char name [];
+};
+
+enum {
+    CONNECT_TIMEOUT = 30,	// Seconds to wait for a server to accept
+    LOW_SPEED_TIME = 60,	// Seconds a download may stall
+    HOST_FAILURE_LIMIT = 3,	// Failures before the server is skipped
+    HOST_COOLDOWN = 5*60,	// First cool-down period, in seconds
+    HOST_MAX_COOLDOWN = 6*60*60
+};
+
+// One feed download. Several of these may be running at once
+// in the multi handle, the rest wait in the queue for a free slot.
+struct transfer {
+    struct transfer* next;
+    struct feed* feed;
+    struct host_state* host;
+    CURL* curl;
+    void (*done)(struct feed* fp);	// Called when the transfer finishes
+    struct curl_slist* headers;		// Extra request headers
+    char* etag;				// ETag response header
+    time_t expires;			// Expires response header
+    time_t retryafter;			// Retry-After response header
+    long maxage;			// Cache-Control max-age, or -1
+    bool skipped;			// Not started because the server is failing
+    bool ratelimited;			// Shares the total download rate limit
+    bool paused;			// Waiting for the rate limit
+    curl_off_t received;		// Bytes counted against the rate limit
+    char* data;				// Received body
+    unsigned size;
+    unsigned capacity;
+};
+
+static CURLM* s_multi = NULL;
+static CURLSH* s_share = NULL;
+static CURL* s_idle_handles [16] = {};	// Reused to keep per-handle caches
+static unsigned s_nidle_handles = 0;
+static struct transfer* s_queue = NULL;
+static struct transfer* s_queue_last = NULL;
+static unsigned s_nqueued = 0;
+static struct transfer* s_active = NULL;	// Transfers in s_multi
+static unsigned s_nactive = 0;
+static struct host_state* s_hosts = NULL;
+static time_t s_deadline = 0;		// Pending downloads are cancelled then
+static int64_t s_rate_tokens = 0;	// Bytes that may be received now
+static struct timespec s_rate_refilled = {};
+
+//}}}-------------------------------------------------------------------
+//{{{ Server failure tracking
+
+static void CleanupHosts (void)
+{
+    while (s_hosts) {
+	struct host_state* h = s_hosts;
+	s_hosts = h->next;
+	free (h);
+    }
+}
+
+// Returns the failure state of the server in url
+static struct host_state* HostState (const char* url)
+{
+    char* name = NULL;
+    CURLU* u = curl_url();
+    if (u && CURLUE_OK == curl_url_set (u, CURLUPART_URL, url, CURLU_GUESS_SCHEME))
+	curl_url_get (u, CURLUPART_HOST, &name, 0);
+    curl_url_cleanup (u);
+    if (!name)
+	return NULL;
+
+    struct host_state* h = s_hosts;
+    while (h && 0 != strcmp (h->name, name))
+	h = h->next;
+    if (!h && (h = calloc (1, sizeof (struct host_state) + strlen (name) + 1))) {
+	if (!s_hosts)
+	    atexit (CleanupHosts);
+	strcpy (h->name, name);
+	h->next = s_hosts;
+	s_hosts = h;
+    }
+    curl_free (name);
+    return h;
+}
+
+// Returns true if the error means the server is down or overloaded,
+// rather than that something is wrong with the feed.
+static bool IsHostFailure (CURLcode rc, long httpcode)
+{
+    switch (rc) {
+	case CURLE_OK:
+	    return httpcode == 429 || httpcode >= 500;
+	case CURLE_COULDNT_RESOLVE_HOST:
+	case CURLE_COULDNT_CONNECT:
+	case CURLE_OPERATION_TIMEDOUT:
+	case CURLE_SSL_CONNECT_ERROR:
+	case CURLE_GOT_NOTHING:
+	case CURLE_SEND_ERROR:
+	case CURLE_RECV_ERROR:
+	    return true;
+	default:
+	    return false;
+    }
+}
+
+static void RecordHostResult (struct host_state* h, bool failed, time_t retryafter)
+{
+    if (!h)
+	return;
+    if (!failed) {
+	h->failures = 0;
+	h->retryafter = 0;
+	return;
+    }
+    if (++h->failures >= HOST_FAILURE_LIMIT) {
+	unsigned doublings = h->failures - HOST_FAILURE_LIMIT;
+	unsigned cooldown = doublings < 8 ? HOST_COOLDOWN << doublings : HOST_MAX_COOLDOWN;
+	if (cooldown > HOST_MAX_COOLDOWN)
+	    cooldown = HOST_MAX_COOLDOWN;
+	h->retryafter = time (NULL) + cooldown;
+    }
+    // Retry-After from an overloaded server applies right away
+    if (h->retryafter < retryafter)
+	h->retryafter = retryafter;
+}
+
+// Returns the time until which downloads from the server
+// of url are skipped, or 0 if they are not.
+time_t HostRetryTime (const char* url)
+{
+    const struct host_state* h = HostState (url);
+    return h && h->retryafter > time (NULL) ? h->retryafter : 0;
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Download rate limit
+//
+// Concurrent downloads share one token bucket, refilled at the
+// configured rate and holding at most one second worth of bytes.
+// A transfer receiving data when the bucket is empty is paused
+// until it refills. A single download uses curl's own limit.
+
+static int64_t MaxRate (void)
+{
+    return _settings.maxrate * INT64_C(1024);
+}
+
+static void RefillRateTokens (void)
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    int64_t ms = (now.tv_sec - s_rate_refilled.tv_sec) * INT64_C(1000) + (now.tv_nsec - s_rate_refilled.tv_nsec) / 1000000;
+    if (ms <= 0)
+	return;
+    s_rate_tokens += ms * MaxRate() / 1000;
+    if (s_rate_tokens > MaxRate())
+	s_rate_tokens = MaxRate();
+    s_rate_refilled = now;
+}
+
+// Returns true if the transfer may receive data now
+static bool TakeRateTokens (struct transfer* t)
+{
+    if (!t->ratelimited || !MaxRate())
+	return true;
+    RefillRateTokens();
+    if (s_rate_tokens <= 0)
+	return false;
+    // Counted on the wire, before decompression. The bucket may go
+    // into debt by one chunk, which delays the next one.
+    curl_off_t received = 0;
+    curl_easy_getinfo (t->curl, CURLINFO_SIZE_DOWNLOAD_T, &received);
+    s_rate_tokens -= received - t->received;
+    t->received = received;
+    return true;
+}
+
+static void ResumePausedTransfers (void)
+{
+    if (!MaxRate())
+	return;
+    RefillRateTokens();
+    for (struct transfer* t = s_active; t && s_rate_tokens > 0; t = t->next) {
+	if (t->paused) {
+	    t->paused = false;
+	    curl_easy_pause (t->curl, CURLPAUSE_CONT);
+	}
+    }
+}
+
+// Returns ms until paused transfers can resume, or 0 if none are paused.
+// curl does not wait for paused transfers, so the caller must sleep.
+static unsigned RateLimitDelay (void)
 {
-    struct feed* fp = vpfeed;
+    bool anypaused = false;
+    for (const struct transfer* t = s_active; t; t = t->next)
+	anypaused |= t->paused;
+    if (!anypaused || !MaxRate())
+	return 0;
+    RefillRateTokens();
+    return (s_rate_tokens < 0 ? -s_rate_tokens * 1000 / MaxRate() : 0) + 1;
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Transfer statistics
+
+// Returns the download statistics age downloads ago, 0 being
+// the last one, or NULL if that many were not recorded.
+const struct fetchstat* FeedFetchStat (const struct feed* fp, unsigned age)
+{
+    if (age >= fp->nfetchstats || age >= FETCH_HISTORY_SIZE)
+	return NULL;
+    return &fp->fetchstats[(fp->nfetchstats - 1 - age) % FETCH_HISTORY_SIZE];
+}
+
+// Returns a cleared slot for a new download record, replacing the oldest
+struct fetchstat* AddFeedFetchStat (struct feed* fp)
+{
+    struct fetchstat* s = &fp->fetchstats[fp->nfetchstats++ % FETCH_HISTORY_SIZE];
+    // Keep the ring position when wrapping the count
+    if (fp->nfetchstats >= 2 * FETCH_HISTORY_SIZE)
+	fp->nfetchstats -= FETCH_HISTORY_SIZE;
+    memset (s, 0, sizeof (*s));
+    fp->cachedirty = true;
+    return s;
+}
+
+static uint32_t TransferTime (CURL* curl, CURLINFO info)
+{
+    curl_off_t us = 0;
+    curl_easy_getinfo (curl, info, &us);
+    return us < 0 ? 0 : us > UINT32_MAX ? UINT32_MAX : (uint32_t) us;
+}
+
+static void RecordFetchStat (struct feed* fp, const struct transfer* t, CURLcode rc, long httpcode)
+{
+    CURL* curl = t->curl;
+    struct fetchstat* s = AddFeedFetchStat (fp);
+    s->time = time (NULL);
+    s->namelookup = TransferTime (curl, CURLINFO_NAMELOOKUP_TIME_T);
+    s->connect = TransferTime (curl, CURLINFO_CONNECT_TIME_T);
+    s->appconnect = TransferTime (curl, CURLINFO_APPCONNECT_TIME_T);
+    s->starttransfer = TransferTime (curl, CURLINFO_STARTTRANSFER_TIME_T);
+    s->total = TransferTime (curl, CURLINFO_TOTAL_TIME_T);
+    s->redirect = TransferTime (curl, CURLINFO_REDIRECT_TIME_T);
+    curl_off_t bytes = 0;
+    curl_easy_getinfo (curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+    s->bytes = bytes < 0 ? 0 : bytes > UINT32_MAX ? UINT32_MAX : (uint32_t) bytes;
+    s->decoded = t->size;
+    long redirects = 0;
+    curl_easy_getinfo (curl, CURLINFO_REDIRECT_COUNT, &redirects);
+    s->redirects = redirects > UINT8_MAX ? UINT8_MAX : redirects;
+    s->httpcode = httpcode;
+    s->curlcode = rc;
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Transfer setup and completion
+
+static size_t FeedReceiver (void* buffer, size_t msz, size_t nm, void* vpt)
+{
+    struct transfer* t = vpt;
+    if (!TakeRateTokens (t)) {
+	t->paused = true;
+	return CURL_WRITEFUNC_PAUSE;
+    }
     size_t size = msz * nm;
-    char* t = realloc (fp->xmltext, fp->content_length + size + 1);
-    if (!t) {
+    size_t need = t->size + size + 1;
+    // Size the buffer for the whole body when the server says how long it is.
+    // A compressed body will be longer, but then grows only a few times.
+    curl_off_t length = -1;
+    if (!t->data && CURLE_OK == curl_easy_getinfo (t->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length)
+	    && length >= 0 && (size_t) length >= need)
+	need = length + 1;
+    if (!RxBufReserve (&t->data, &t->capacity, t->size, need)) {
 	fprintf (stderr, "Error: out of memory\n");
 	exit (EXIT_FAILURE);
     }
-    fp->xmltext = t;
-    memcpy (&fp->xmltext[fp->content_length], buffer, size);
-    fp->content_length += size;
-    fp->xmltext [fp->content_length] = 0;
+    memcpy (&t->data[t->size], buffer, size);
+    t->size += size;
+    t->data[t->size] = 0;
     return size;
 }
 
-// Returns allocated string with body of webserver reply.
-// Various status info put into struct feed* fp.
-void DownloadFeed (const char* url, struct feed* fp)
+static void CleanupShare (void)
 {
-    // Default to error
-    fp->problem = true;
-    if (fp->lasterror) {
-	free (fp->lasterror);
-	fp->lasterror = NULL;
+    curl_share_cleanup (s_share);
+    s_share = NULL;
+}
+
+static void CleanupIdleHandles (void)
+{
+    while (s_nidle_handles)
+	curl_easy_cleanup (s_idle_handles[--s_nidle_handles]);
+}
+
+// If the header line is "name: value", returns allocated value
+static char* HeaderValue (const char* line, size_t linesz, const char* name)
+{
+    size_t namelen = strlen (name);
+    if (linesz <= namelen || line[namelen] != ':' || 0 != strncasecmp (line, name, namelen))
+	return NULL;
+    const char *v = &line[namelen+1], *vend = &line[linesz];
+    while (v < vend && isspace (*v))
+	++v;
+    while (vend > v && isspace (vend[-1]))
+	--vend;
+    return strndup (v, vend - v);
+}
+
+static size_t HeaderReceiver (char* buffer, size_t msz, size_t nm, void* vpt)
+{
+    struct transfer* t = vpt;
+    size_t size = msz * nm;
+    // Each redirect response begins a new set of headers
+    if (size > strlen("HTTP/") && 0 == strncmp (buffer, "HTTP/", strlen("HTTP/"))) {
+	free (t->etag);
+	t->etag = NULL;
+	t->expires = 0;
+	t->retryafter = 0;
+	t->maxage = -1;
     }
+    char* v = HeaderValue (buffer, size, "ETag");
+    if (v) {
+	free (t->etag);
+	t->etag = v;
+    } else if ((v = HeaderValue (buffer, size, "Cache-Control"))) {
+	const char* maxage = s_strcasestr (v, "max-age=");
+	if (maxage)
+	    t->maxage = atol (maxage + strlen ("max-age="));
+	free (v);
+    } else if ((v = HeaderValue (buffer, size, "Expires"))) {
+	time_t expires = curl_getdate (v, NULL);
+	t->expires = expires > 0 ? expires : 0;
+	free (v);
+    } else if ((v = HeaderValue (buffer, size, "Retry-After"))) {
+	// Either a number of seconds or a date
+	char* vend = NULL;
+	unsigned long delay = strtoul (v, &vend, 10);
+	time_t retryafter = *v && !*vend ? time (NULL) + (time_t) delay : curl_getdate (v, NULL);
+	t->retryafter = retryafter > 0 ? retryafter : 0;
+	free (v);
+    }
+    return size;
+}
 
-    // libcurl global init must be called only once
-    // snownews is single threaded, so no fancy locks needed
+static bool InitCurl (void)
+{
+    // libcurl global init must be called only once. Downloads are
+    // only started from the main thread; the cache loader threads do
+    // not use curl, so no locks are needed.
     static bool s_curl_initialized = false;
     if (!s_curl_initialized) {
 	if (0 != curl_global_init (CURL_GLOBAL_DEFAULT)) {
 	    UIStatus ("Error: failed to initialize libcurl", 2, 1);
 	    syslog (LOG_ERR, "failed to initialize libcurl");
-	    return;
+	    return false;
 	}
 	atexit (curl_global_cleanup);
 	s_curl_initialized = true;
+
+	// All transfers share DNS lookups, open connections, and TLS
+	// sessions, so that many feeds from one server can be fetched
+	// over one connection with only one handshake.
+	if ((s_share = curl_share_init())) {
+	    curl_share_setopt (s_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	    curl_share_setopt (s_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+	    curl_share_setopt (s_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	    atexit (CleanupShare);
+	}
+	// Handles must be freed before the share
+	atexit (CleanupIdleHandles);
+    }
+    return true;
+}
+
+// Returns an idle curl handle, or a new one if there are none
+static CURL* AcquireCurlHandle (void)
+{
+    if (s_nidle_handles)
+	return s_idle_handles[--s_nidle_handles];
+    return curl_easy_init();
+}
+
+static void ReleaseCurlHandle (CURL* curl)
+{
+    if (s_nidle_handles >= sizeof(s_idle_handles)/sizeof(s_idle_handles[0]))
+	return curl_easy_cleanup (curl);
+    curl_easy_reset (curl);
+    s_idle_handles[s_nidle_handles++] = curl;
+}
+
+// Creates a curl handle set up to download url into a new transfer buffer.
+static struct transfer* NewTransfer (const char* url, struct feed* fp)
+{
+    if (fp->lasterror) {
+	free (fp->lasterror);
+	fp->lasterror = NULL;
     }
+    if (!InitCurl())
+	return NULL;
+
+    struct transfer* t = calloc (1, sizeof (struct transfer));
+    if (!t)
+	return NULL;
+    t->feed = fp;
+    t->host = HostState (url);
+    t->maxage = -1;
 
     // Setup CURL connection
-    CURL* curl = curl_easy_init();
-    if (!curl)
-	return;
+    CURL* curl = t->curl = AcquireCurlHandle();
+    if (!curl) {
+	free (t);
+	return NULL;
+    }
+    if (s_share)
+	curl_easy_setopt (curl, CURLOPT_SHARE, s_share);
+    curl_easy_setopt (curl, CURLOPT_PRIVATE, t);
     curl_easy_setopt (curl, CURLOPT_URL, url);
     curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, FeedReceiver);
-    curl_easy_setopt (curl, CURLOPT_WRITEDATA, fp);
+    curl_easy_setopt (curl, CURLOPT_WRITEDATA, t);
+    curl_easy_setopt (curl, CURLOPT_HEADERFUNCTION, HeaderReceiver);
+    curl_easy_setopt (curl, CURLOPT_HEADERDATA, t);
     curl_easy_setopt (curl, CURLOPT_USERAGENT, SNOWNEWS_NAME "/" SNOWNEWS_VERSTRING);
     curl_easy_setopt (curl, CURLOPT_BUFFERSIZE, CURL_MAX_READ_SIZE);
+    // Offer every compression curl can decode; FeedReceiver gets plain text
+    curl_easy_setopt (curl, CURLOPT_ACCEPT_ENCODING, "");
     curl_easy_setopt (curl, CURLOPT_FOLLOWLOCATION, 1);
     curl_easy_setopt (curl, CURLOPT_MAXREDIRS, 8);
     curl_easy_setopt (curl, CURLOPT_AUTOREFERER, 1);
 
+    // Give up on servers that do not answer or stall
+    curl_easy_setopt (curl, CURLOPT_CONNECTTIMEOUT, (long) CONNECT_TIMEOUT);
+    curl_easy_setopt (curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt (curl, CURLOPT_LOW_SPEED_TIME, (long) LOW_SPEED_TIME);
+    curl_easy_setopt (curl, CURLOPT_TIMEOUT, (long) _settings.feedtimeout);
+
     // Avoid redownloading if not modified
     curl_easy_setopt (curl, CURLOPT_FILETIME, 1);
     if (fp->lastmodified > 0) {
 	curl_easy_setopt (curl, CURLOPT_TIMEVALUE, fp->lastmodified);
 	curl_easy_setopt (curl, CURLOPT_TIMECONDITION, CURL_TIMECOND_IFMODSINCE);
     }
+    if (fp->etag) {
+	char inmheader [strlen("If-None-Match: ") + strlen(fp->etag) + 1];
+	snprintf (inmheader, sizeof(inmheader), "If-None-Match: %s", fp->etag);
+	t->headers = curl_slist_append (NULL, inmheader);
+	curl_easy_setopt (curl, CURLOPT_HTTPHEADER, t->headers);
+    }
 
     // Cookies, if the cookie file is in the config dir
     char cookiefile [PATH_MAX];
     ConfigFilePath ("cookies", cookiefile, sizeof(cookiefile));
     if (access (cookiefile, R_OK) == 0)
 	curl_easy_setopt (curl, CURLOPT_COOKIEFILE, cookiefile);
+    return t;
+}
 
-    // Save old content
-    char* oldxmltext = fp->xmltext;
-    unsigned oldcontent_length = fp->content_length;
-    fp->xmltext = NULL;
-    fp->content_length = 0;
+static void FreeTransfer (struct transfer* t)
+{
+    ReleaseCurlHandle (t->curl);
+    curl_slist_free_all (t->headers);
+    free (t->etag);
+    RxBufRelease (&t->data, &t->capacity);
+    free (t);
+}
+
+// Records when the server allows the feed to be fetched again.
+// Cache-Control max-age takes precedence over Expires. A 304 reply
+// without either keeps the expiration of the cached response.
+static void SetFeedExpiration (struct feed* fp, const struct transfer* t, bool notmodified)
+{
+    fp->lastfetch = time (NULL);
+    if (t->maxage >= 0)
+	fp->expires = fp->lastfetch + t->maxage;
+    else if (t->expires || !notmodified)
+	fp->expires = t->expires;
+}
+
+// Returns true if the server of t is being skipped after failures
+static bool SkipTransfer (struct transfer* t)
+{
+    if (!t->host || t->host->retryafter <= time (NULL))
+	return false;
+    t->skipped = true;
+    return true;
+}
+
+// Moves the downloaded text into the feed, or records the error.
+// Status messages are only shown when verbose; a background refresh
+// of many feeds should not stop for each one.
+static void FinishTransfer (struct transfer* t, CURLcode rc, bool verbose)
+{
+    struct feed* fp = t->feed;
+    if (t->skipped) {
+	fp->problem = true;
+	fp->downloadtime = 0;
+	char timebuf [16], msgbuf [128];
+	strftime (timebuf, sizeof(timebuf), "%H:%M", localtime (&t->host->retryafter));
+	snprintf (msgbuf, sizeof(msgbuf), _("Server not responding, skipped until %s"), timebuf);
+	fp->lasterror = strdup (msgbuf);
+	if (verbose)
+	    UIStatus (msgbuf, 2, 1);
+	return FreeTransfer (t);
+    }
+    long unmet = 0, httpcode = 0;
+    curl_easy_getinfo (t->curl, CURLINFO_CONDITION_UNMET, &unmet);
+    curl_easy_getinfo (t->curl, CURLINFO_RESPONSE_CODE, &httpcode);
+    RecordFetchStat (fp, t, rc, httpcode);
+    fp->downloadtime = FeedFetchStat (fp, 0)->total / 1000;
+    RecordHostResult (t->host, IsHostFailure (rc, httpcode), t->retryafter);
 
-    // Download the new feed
-    CURLcode rc = curl_easy_perform (curl);
-    if (rc == CURLE_OK && fp->content_length)  {
+    if (rc == CURLE_OK && httpcode < 400 && t->size) {
 	//
-	// Transfer successful
+	// Transfer successful, replace the old text
 	//
 	fp->problem = false;
-	if (oldxmltext) {
-	    free (oldxmltext);
-	    oldxmltext = NULL;
-	}
+	RxBufRelease (&fp->xmltext, &fp->xmlcapacity);
+	fp->xmltext = t->data;
+	fp->xmlcapacity = t->capacity;
+	fp->content_length = t->size;
+	t->data = NULL;
+	t->capacity = 0;
+
 	long filetime = 0;
-	if (CURLE_OK == curl_easy_getinfo (curl, CURLINFO_FILETIME, &filetime) && filetime > 0)
+	if (CURLE_OK == curl_easy_getinfo (t->curl, CURLINFO_FILETIME, &filetime) && filetime > 0)
 	    fp->lastmodified = filetime;
+	free (fp->etag);
+	fp->etag = t->etag;
+	t->etag = NULL;
+	SetFeedExpiration (fp, t, false);
     } else {
 	//
-	// On error, free downloaded text and restore original
+	// On error, keep the original text
 	//
-	if (fp->xmltext)
-	    free (fp->xmltext);
-	fp->xmltext = oldxmltext;
-	fp->content_length = oldcontent_length;
-
 	// Check if failed because already up-to-date
-	long unmet = 0;
-	if (CURLE_OK == curl_easy_getinfo (curl, CURLINFO_CONDITION_UNMET, &unmet) && unmet) {
+	if (rc == CURLE_OK && (unmet || httpcode == 304)) {
+	    // A 304 reply may carry an updated validator
+	    if (t->etag) {
+		free (fp->etag);
+		fp->etag = t->etag;
+		t->etag = NULL;
+	    }
+	    SetFeedExpiration (fp, t, true);
 	    fp->lasterror = strdup (_("already up to date"));
-	    UIStatus (fp->lasterror, 0, 0);
+	    if (verbose)
+		UIStatus (fp->lasterror, 0, 0);
 	    fp->problem = false;
 	} else {
 	    // The error is stored in fp->lasterror for display
+	    fp->problem = true;
+	    // An overloaded server may say when to try again
+	    if (fp->expires < t->retryafter)
+		fp->expires = t->retryafter;
+	    char httperror [32];
 	    const char* cerrt = curl_easy_strerror (rc);
+	    if (rc == CURLE_OK && httpcode >= 400) {
+		snprintf (httperror, sizeof(httperror), _("HTTP error %ld"), httpcode);
+		cerrt = httperror;
+	    }
 	    if (cerrt) {
 		fp->lasterror = strdup (cerrt);
-		UIStatus (cerrt, 2, 1);
+		if (verbose)
+		    UIStatus (cerrt, 2, 1);
 		syslog (LOG_ERR, "%s", cerrt);
 	    }
 	}
     }
-    curl_easy_cleanup (curl);
+    FreeTransfer (t);
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Single download
+
+// Downloads url into fp->xmltext, waiting until done.
+// Various status info put into struct feed* fp.
+void DownloadFeed (const char* url, struct feed* fp)
+{
+    struct transfer* t = NewTransfer (url, fp);
+    if (t && MaxRate())
+	curl_easy_setopt (t->curl, CURLOPT_MAX_RECV_SPEED_LARGE, (curl_off_t) MaxRate());
+    if (t)
+	FinishTransfer (t, SkipTransfer (t) ? CURLE_OK : curl_easy_perform (t->curl), true);
+    else
+	fp->problem = true;
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Concurrent downloads
+
+static void CleanupMulti (void)
+{
+    curl_multi_cleanup (s_multi);
+    s_multi = NULL;
+}
+
+static bool InitMulti (void)
+{
+    if (s_multi)
+	return true;
+    if (!InitCurl() || !(s_multi = curl_multi_init()))
+	return false;
+    curl_multi_setopt (s_multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) _settings.hostconnections);
+    atexit (CleanupMulti);
+    return true;
+}
+
+static void CompleteTransfer (struct transfer* t, CURLcode rc)
+{
+    struct feed* fp = t->feed;
+    void (*done)(struct feed*) = t->done;
+    FinishTransfer (t, rc, false);
+    if (done)
+	done (fp);
+}
+
+// Moves queued transfers into the multi handle while there are free slots.
+static void StartQueuedTransfers (void)
+{
+    unsigned maxactive = _settings.maxdownloads ? _settings.maxdownloads : 1;
+    while (s_queue && s_nactive < maxactive) {
+	struct transfer* t = s_queue;
+	if (!(s_queue = t->next))
+	    s_queue_last = NULL;
+	t->next = NULL;
+	--s_nqueued;
+	// Checked here rather than when queued, to also skip the feeds
+	// queued together with the ones that found the server failing.
+	if (SkipTransfer (t))
+	    CompleteTransfer (t, CURLE_OK);
+	else if (CURLM_OK == curl_multi_add_handle (s_multi, t->curl)) {
+	    t->next = s_active;
+	    s_active = t;
+	    ++s_nactive;
+	} else
+	    CompleteTransfer (t, CURLE_FAILED_INIT);
+    }
+}
+
+// Starts downloading fp->feedurl in the background. When finished,
+// the result is stored as in DownloadFeed and done is called.
+bool QueueFeedDownload (struct feed* fp, void (*done)(struct feed* fp))
+{
+    if (!InitMulti())
+	return false;
+    struct transfer* t = NewTransfer (fp->feedurl, fp);
+    if (!t)
+	return false;
+    t->done = done;
+    t->ratelimited = true;
+    if (s_queue_last)
+	s_queue_last->next = t;
+    else
+	s_queue = t;
+    s_queue_last = t;
+    ++s_nqueued;
+    StartQueuedTransfers();
+    return true;
+}
+
+// Number of queued or running downloads
+unsigned PendingDownloads (void)
+{
+    return s_nqueued + s_nactive;
+}
+
+// Returns true if fp is being downloaded or waits to be
+bool FeedDownloadPending (const struct feed* fp)
+{
+    for (const struct transfer* t = s_active; t; t = t->next)
+	if (t->feed == fp)
+	    return true;
+    for (const struct transfer* t = s_queue; t; t = t->next)
+	if (t->feed == fp)
+	    return true;
+    return false;
+}
+
+// Removes t from the singly linked list at *pl
+static void UnlinkTransfer (struct transfer** pl, const struct transfer* t)
+{
+    for (; *pl; pl = &(*pl)->next) {
+	if (*pl == t) {
+	    *pl = t->next;
+	    return;
+	}
+    }
+}
+
+// Cancels the downloads of fp, or all downloads if fp is NULL, without
+// calling their completion callbacks. Returns the number cancelled.
+static unsigned CancelDownloads (const struct feed* fp)
+{
+    unsigned n = 0;
+    for (struct transfer* t = s_active, *next; t; t = next) {
+	next = t->next;
+	if (fp && t->feed != fp)
+	    continue;
+	UnlinkTransfer (&s_active, t);
+	curl_multi_remove_handle (s_multi, t->curl);
+	--s_nactive;
+	FreeTransfer (t);
+	++n;
+    }
+    for (struct transfer* t = s_queue, *prev = NULL, *next; t; t = next) {
+	next = t->next;
+	if (fp && t->feed != fp) {
+	    prev = t;
+	    continue;
+	}
+	UnlinkTransfer (&s_queue, t);
+	if (s_queue_last == t)
+	    s_queue_last = prev;
+	--s_nqueued;
+	FreeTransfer (t);
+	++n;
+    }
+    if (s_multi)
+	StartQueuedTransfers();
+    return n;
 }
+
+// Stops downloading fp. Must be called before fp is freed.
+void CancelFeedDownload (const struct feed* fp)
+{
+    CancelDownloads (fp);
+}
+
+// Cancels all downloads without calling their completion callbacks.
+// The feeds keep their old items. Returns the number cancelled.
+unsigned CancelAllDownloads (void)
+{
+    return CancelDownloads (NULL);
+}
+
+// Sets the time when the downloads pending then are cancelled.
+// Cleared when all downloads finish.
+void SetDownloadDeadline (time_t deadline)
+{
+    s_deadline = deadline;
+}
+
+// Advances all running downloads, calling the completion callbacks
+// of those that finished, and starts queued ones in their place.
+static void ProcessDownloads (void)
+{
+    if (s_deadline && time (NULL) >= s_deadline) {
+	s_deadline = 0;
+	unsigned ncancelled = CancelAllDownloads();
+	char msgbuf [128];
+	snprintf (msgbuf, sizeof(msgbuf), _("Refresh took too long, %u feeds were not updated"), ncancelled);
+	UIStatus (msgbuf, 1, 1);
+	syslog (LOG_WARNING, "%s", msgbuf);
+    }
+    ResumePausedTransfers();
+    int running = 0;
+    curl_multi_perform (s_multi, &running);
+
+    CURLMsg* msg;
+    int msgsleft = 0;
+    while ((msg = curl_multi_info_read (s_multi, &msgsleft))) {
+	if (msg->msg != CURLMSG_DONE)
+	    continue;
+	CURL* curl = msg->easy_handle;
+	CURLcode rc = msg->data.result;
+	struct transfer* t = NULL;
+	curl_easy_getinfo (curl, CURLINFO_PRIVATE, &t);
+	curl_multi_remove_handle (s_multi, curl);
+	UnlinkTransfer (&s_active, t);
+	--s_nactive;
+	CompleteTransfer (t, rc);
+    }
+    StartQueuedTransfers();
+    if (!s_nactive && !s_nqueued)
+	s_deadline = 0;
+}
+
+// Processes downloads, then waits up to timeout ms for network activity.
+void RunDownloads (unsigned timeout)
+{
+    if (!s_multi)
+	return;
+    ProcessDownloads();
+    unsigned delay = RateLimitDelay();
+    if (delay)
+	poll (NULL, 0, delay < timeout ? delay : timeout);
+    else if (s_nactive)
+	curl_multi_wait (s_multi, NULL, 0, timeout, NULL);
+}
+
+// Waits up to timeout for downloads, or until one of fds is ready,
+// setting their revents. Returns the number of fds ready. Takes
+// at most DOWNLOAD_POLL_MAX fds.
+unsigned RunDownloadsPoll (struct pollfd* fds, unsigned nfds, unsigned timeout)
+{
+    for (unsigned i = 0; i < nfds; ++i)
+	fds[i].revents = 0;
+    if (s_multi) {
+	ProcessDownloads();
+	unsigned delay = RateLimitDelay();
+	if (delay && delay < timeout)
+	    timeout = delay;
+	else if (!delay && s_nactive) {
+	    struct curl_waitfd wfds [DOWNLOAD_POLL_MAX];
+	    assert (nfds <= sizeof(wfds)/sizeof(wfds[0]));
+	    for (unsigned i = 0; i < nfds; ++i)
+		wfds[i] = (struct curl_waitfd) { .fd = fds[i].fd, .events = CURL_WAIT_POLLIN };
+	    curl_multi_wait (s_multi, wfds, nfds, timeout, NULL);
+	    unsigned nready = 0;
+	    for (unsigned i = 0; i < nfds; ++i)
+		if (wfds[i].revents & CURL_WAIT_POLLIN) {
+		    fds[i].revents = POLLIN;
+		    ++nready;
+		}
+	    return nready;
+	}
+    }
+    int nready = poll (fds, nfds, timeout);
+    return nready > 0 ? nready : 0;
+}
+
+//}}}-------------------------------------------------------------------
@@ -16,6 +16,20 @@
 // along with Snownews. If not, see http://www.gnu.org/licenses/.
 
 #pragma once
-#include "main.h"
+#include "filters.h"
+#include <poll.h>
+
+enum { DOWNLOAD_POLL_MAX = 1 + EXEC_POOL_SIZE };	// Most fds for RunDownloadsPoll: a key input and the exec feeds
 
 void DownloadFeed (const char* url, struct feed* cur_ptr);
+bool QueueFeedDownload (struct feed* fp, void (*done)(struct feed* fp));
+unsigned PendingDownloads (void);
+bool FeedDownloadPending (const struct feed* fp);
+void CancelFeedDownload (const struct feed* fp);
+unsigned CancelAllDownloads (void);
+void SetDownloadDeadline (time_t deadline);
+void RunDownloads (unsigned timeout);
+unsigned RunDownloadsPoll (struct pollfd* fds, unsigned nfds, unsigned timeout);
+time_t HostRetryTime (const char* url);
+const struct fetchstat* FeedFetchStat (const struct feed* fp, unsigned age);
+struct fetchstat* AddFeedFetchStat (struct feed* fp);
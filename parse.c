@@ -19,17 +19,15 @@
 #include "parse.h"
 #include "feedio.h"
 #include "conv.h"
+#include "arena.h"
 #include <libxml/parser.h>
 
 //{{{ Local variables --------------------------------------------------
 
-static bool saverestore = false;
-static struct newsitem* copy = NULL;
-static struct newsitem* firstcopy = NULL;
-
 static const char dcNs[] = "http://purl.org/dc/elements/1.1/";
 static const char snowNs[] = "http://snownews.kcore.de/ns/1.0/";
 static const char contentNs[] = "http://purl.org/rss/1.0/modules/content/";
+static const char syNs[] = "http://purl.org/rss/1.0/modules/syndication/";
 
 //}}}-------------------------------------------------------------------
 //{{{ free_feed
@@ -39,23 +37,9 @@ static void free_feed (struct feed* feed)
     free (feed->title);
     free (feed->link);
     free (feed->description);
-    if (feed->items) {
-	while (feed->items->next) {
-	    feed->items = feed->items->next;
-	    free (feed->items->prev->data->title);
-	    free (feed->items->prev->data->link);
-	    free (feed->items->prev->data->description);
-	    free (feed->items->prev->data->hash);
-	    free (feed->items->prev->data);
-	    free (feed->items->prev);
-	}
-	free (feed->items->data->title);
-	free (feed->items->data->link);
-	free (feed->items->data->description);
-	free (feed->items->data->hash);
-	free (feed->items->data);
-	free (feed->items);
-    }
+    // All items and their strings are in the arena
+    FreeArena (feed->itemarena);
+    feed->itemarena = NULL;
     feed->items = NULL;
     feed->title = NULL;
     feed->link = NULL;
@@ -73,373 +57,709 @@ static bool node_name_is (xmlNodePtr pn, const char* name)
     return 0 == xmlStrcmp (pn->name, (const xmlChar*) name);
 }
 
-static bool node_ns_name_is (xmlNodePtr pn, const char* ns, const char* name)
-{
-    return pn->ns
-	&& 0 == xmlStrcmp (pn->ns->href, (const xmlChar*) ns)
-	&& node_name_is (pn, name);
-}
-
-static void copy_node_text_to (xmlDocPtr doc, xmlNodePtr pn, char** pd, bool fullclean)
+static void copy_node_prop_to (xmlNodePtr pn, const char* name, char** pd, bool fullclean)
 {
-    char* nt = (char*) xmlNodeListGetString (doc, pn->children, 1);
-    if (!nt)
-	return; // don't overwrite with empty
-    if (!nt[0])
-	return free (nt);
     if (*pd)
-	free (*pd);
-    *pd = nt;
+	xmlFree (*pd);
+    *pd = (char*) xmlGetProp (pn, (const xmlChar*) name);
     CleanupString (*pd, fullclean);
 }
 
-static long number_from_node_text (xmlDocPtr doc, xmlNodePtr pn)
+//}}}-------------------------------------------------------------------
+//{{{ Read status set
+//
+// When a feed is reparsed, the read status of its items is restored
+// by looking up their hashes in this open addressing table built from
+// the old items. The hex MD5 hashes are stored in binary form.
+
+enum { ITEM_DIGEST_SIZE = 16 };
+
+struct readstatus_entry {
+    uint8_t digest [ITEM_DIGEST_SIZE];
+    bool used;
+    bool readstatus;
+};
+
+struct readstatus_set {
+    struct readstatus_entry* entries;
+    unsigned capacity;		// Always a power of 2
+};
+
+// Converts hex item hash to binary, returning false if it is not one.
+static bool item_digest_from_hash (const char* hash, uint8_t* digest)
 {
-    char* s = NULL;
-    copy_node_text_to (doc, pn, &s, false);
-    long v = atol(s);
-    free (s);
-    return v;
+    for (unsigned i = 0; i < 2*ITEM_DIGEST_SIZE; ++i) {
+	char c = hash[i];
+	unsigned v;
+	if (c >= '0' && c <= '9')
+	    v = c - '0';
+	else if (c >= 'a' && c <= 'f')
+	    v = c - 'a' + 10;
+	else if (c >= 'A' && c <= 'F')
+	    v = c - 'A' + 10;
+	else
+	    return false;
+	digest[i/2] = (i % 2) ? (digest[i/2] | v) : (v << 4);
+    }
+    return !hash[2*ITEM_DIGEST_SIZE];
 }
 
-static time_t pubDate_from_node_text (xmlDocPtr doc, xmlNodePtr pn)
+// Returns the entry for digest, or the empty slot where it would go.
+static struct readstatus_entry* readstatus_slot (const struct readstatus_set* set, const uint8_t* digest)
 {
-    char* s = NULL;
-    copy_node_text_to (doc, pn, &s, false);
-    time_t t = pubDateToUnix (s);
-    free (s);
-    return t;
+    // MD5 output is uniform, so its first bytes make a good table index
+    uint32_t h;
+    memcpy (&h, digest, sizeof(h));
+    for (unsigned i = h;; ++i) {
+	struct readstatus_entry* e = &set->entries [i & (set->capacity-1)];
+	if (!e->used || 0 == memcmp (e->digest, digest, ITEM_DIGEST_SIZE))
+	    return e;
+    }
 }
 
-static time_t ISODate_from_node_text (xmlDocPtr doc, xmlNodePtr pn)
+static void readstatus_set_init (struct readstatus_set* set, const struct newsitem* items)
 {
-    char* s = NULL;
-    copy_node_text_to (doc, pn, &s, false);
-    time_t t = ISODateToUnix (s);
-    free (s);
-    return t;
+    unsigned nitems = 0;
+    for (const struct newsitem* i = items; i; i = i->next)
+	++nitems;
+    if (!nitems)
+	return;
+    // Keep the load factor under 1/2 for short probe sequences
+    set->capacity = 16;
+    while (set->capacity < 2*nitems)
+	set->capacity *= 2;
+    set->entries = calloc (set->capacity, sizeof (struct readstatus_entry));
+    if (!set->entries)
+	return;
+    for (const struct newsitem* i = items; i; i = i->next) {
+	uint8_t digest [ITEM_DIGEST_SIZE];
+	if (!i->data->hash || !item_digest_from_hash (i->data->hash, digest))
+	    continue;
+	struct readstatus_entry* e = readstatus_slot (set, digest);
+	if (e->used)
+	    continue;	// Keep the first of duplicates
+	memcpy (e->digest, digest, ITEM_DIGEST_SIZE);
+	e->used = true;
+	e->readstatus = i->data->readstatus;
+    }
 }
 
-static void copy_node_prop_to (xmlNodePtr pn, const char* name, char** pd, bool fullclean)
+// Sets readstatus of item from the set if it has been seen before
+static void readstatus_set_restore (const struct readstatus_set* set, struct newsitem* item)
 {
-    if (*pd)
-	xmlFree (*pd);
-    *pd = (char*) xmlGetProp (pn, (const xmlChar*) name);
-    CleanupString (*pd, fullclean);
+    uint8_t digest [ITEM_DIGEST_SIZE];
+    if (!set->entries || !item_digest_from_hash (item->data->hash, digest))
+	return;
+    const struct readstatus_entry* e = readstatus_slot (set, digest);
+    if (e->used)
+	item->data->readstatus = e->readstatus;
 }
 
 //}}}-------------------------------------------------------------------
-//{{{ RSS 1 parsing
+//{{{ Feed parser state
+//
+// Feeds are parsed with the SAX2 push parser, building newsitems
+// directly as elements are closed. No document tree is built, so
+// memory use does not depend on feed size, and the text can be
+// given to the parser in pieces as it arrives.
+
+enum EFeedFormat { format_none, format_unknown, format_rdf, format_rss, format_atom };
+
+// What to do with the text of the element being read
+enum EFeedField {
+    field_none,
+    field_channel_title,
+    field_channel_link,
+    field_channel_description,
+    field_channel_ttl,
+    field_channel_update_period,
+    field_channel_update_frequency,
+    field_item_title,
+    field_item_link,
+    field_item_description,
+    field_item_summary,
+    field_item_guid,
+    field_item_pubdate,
+    field_item_isodate,
+    field_item_readstatus,
+    field_item_hash,
+    field_item_date,
+    field_lastmodified,
+    field_etag,
+    field_digest
+};
+
+// Elements the parser looks for. Their names are interned in the parser
+// dictionary, where libxml also keeps the names it gives to the SAX
+// callbacks, so an element is identified by a hash lookup of the name
+// pointer, instead of comparing the name with each of them.
+enum EElement {
+    elem_other,
+    elem_RDF,
+    elem_rss,
+    elem_feed,
+    elem_channel,
+    elem_item,
+    elem_entry,
+    elem_title,
+    elem_link,
+    elem_description,
+    elem_ttl,
+    elem_updatePeriod,
+    elem_updateFrequency,
+    elem_summary,
+    elem_content,
+    elem_id,
+    elem_updated,
+    elem_guid,
+    elem_pubDate,
+    elem_readstatus,
+    elem_encoded,
+    elem_date,
+    elem_hash,
+    elem_lastmodified,
+    elem_etag,
+    elem_digest,
+    elem_count
+};
+
+static const char* const c_element_names [elem_count] = {
+    "", "RDF", "rss", "feed", "channel", "item", "entry", "title", "link",
+    "description", "ttl", "updatePeriod", "updateFrequency", "summary",
+    "content", "id", "updated", "guid", "pubDate", "readstatus", "encoded",
+    "date", "hash", "lastmodified", "etag", "digest"
+};
+
+enum ENamespace { ns_other, ns_dc, ns_snow, ns_content, ns_sy, ns_count };
+
+static const char* const c_namespaces [ns_count] = { "", dcNs, snowNs, contentNs, syNs };
+
+enum { ELEMENT_SLOTS = 64 };	// Power of 2, over twice elem_count
+
+struct element_names {
+    const xmlChar* ns [ns_count];
+    struct {
+	const xmlChar* name;
+	enum EElement id;
+    } slot [ELEMENT_SLOTS];
+};
+
+struct feed_parser {
+    xmlParserCtxtPtr ctxt;
+    struct element_names names;
+    struct feed* feed;
+    struct newsitem* item;	// The item being read
+    struct newsitem* lastitem;	// Tail of feed->items, for appending
+    char* guid;			// Its guid, used for the hash
+    struct readstatus_set oldstatus;	// Read status of items before the reparse
+    char* text;			// Text of the field element being read
+    size_t textlen;
+    size_t textcap;
+    unsigned depth;		// Current element nesting level
+    unsigned channeldepth;	// Level of the <channel> element
+    unsigned itemdepth;		// Level of the <item> element
+    unsigned fielddepth;	// Level of the field element
+    unsigned ttl;		// <ttl> in minutes
+    unsigned updateperiod;	// sy:updatePeriod in seconds
+    unsigned updatefrequency;	// sy:updateFrequency, times per period
+    enum EFeedFormat format;
+    enum EFeedField field;
+    bool fullclean;		// Remove newlines from field text
+};
+
+static unsigned element_slot (const xmlChar* name)
+{
+    return (uint32_t) ((uintptr_t) name >> 3) * 2654435761u >> 26;
+}
 
-// This function is called every time we hit an <item>.  As parameter it
-// needs the current newsfeed (struct newsfeed*), as well as the current
-// XML Document handle and the current element, both come directly from
-// the libxml.
+// Interns the known names in the dictionary of the parser
+static void intern_element_names (struct element_names* en, xmlDictPtr dict)
+{
+    for (unsigned i = 1; i < ns_count; ++i)
+	en->ns[i] = xmlDictLookup (dict, (const xmlChar*) c_namespaces[i], -1);
+    for (unsigned i = 1; i < elem_count; ++i) {
+	const xmlChar* name = xmlDictLookup (dict, (const xmlChar*) c_element_names[i], -1);
+	if (!name)
+	    continue;
+	unsigned h = element_slot (name);
+	while (en->slot[h].name)
+	    h = (h + 1) % ELEMENT_SLOTS;
+	en->slot[h].name = name;
+	en->slot[h].id = i;
+    }
+}
 
-static void parse_rdf10_item (struct feed* feed, xmlDocPtr doc, xmlNodePtr node)
+// Identifies the SAX2 element name, which comes from the dictionary
+static enum EElement element_id (const struct element_names* en, const xmlChar* name)
 {
-    // Reserve memory for a new news item
-    struct newsitem* item = calloc (1, sizeof (struct newsitem));
-    item->data = calloc (1, sizeof (struct newsdata));
-    item->data->parent = feed;
+    for (unsigned h = element_slot (name);; h = (h + 1) % ELEMENT_SLOTS) {
+	if (en->slot[h].name == name)
+	    return en->slot[h].id;
+	if (!en->slot[h].name)
+	    return elem_other;
+    }
+}
 
-    char* guid = NULL;
+static enum ENamespace namespace_id (const struct element_names* en, const xmlChar* uri)
+{
+    for (unsigned i = 1; uri && i < ns_count; ++i)
+	if (en->ns[i] == uri)
+	    return i;
+    return ns_other;
+}
 
-    // Go through all the tags in the <item> tag and extract the information.
-    // same procedure as in the parse_channel() function
-    for (xmlNodePtr cur = node; cur != NULL; cur = cur->next) {
-	if (cur->type != XML_ELEMENT_NODE)
+// Returns allocated value of attribute name from the SAX2 attribute
+// array of 5 pointers per attribute: localname/prefix/URI/value/end.
+static char* attribute_value (int nattrs, const xmlChar** attrs, const char* name)
+{
+    for (int i = 0; i < nattrs; ++i, attrs += 5) {
+	if (0 != xmlStrcmp (attrs[0], (const xmlChar*) name))
 	    continue;
+	char* v = strndup ((const char*) attrs[3], attrs[4] - attrs[3]);
+	// Without entity substitution, the parser leaves &amp; in
+	// attribute values as a character reference for the tree builder.
+	static const char c_ampref[] = "&#38;";
+	size_t len = strlen (v);
+	for (char* vi = v; (vi = strstr (vi, c_ampref)); ++vi) {
+	    len -= strlen (c_ampref) - 1;
+	    memmove (vi + 1, vi + strlen (c_ampref), len - (vi - v));
+	}
+	return v;
+    }
+    return NULL;
+}
 
-	// Basic RSS
-	if (node_name_is (cur, "title"))
-	    copy_node_text_to (doc, cur, &item->data->title, true);
-	else if (node_name_is (cur, "link"))
-	    copy_node_text_to (doc, cur, &item->data->link, false);
-	else if (node_name_is (cur, "description"))
-	    copy_node_text_to (doc, cur, &item->data->description, false);
+// Replaces *pd with the text read from the field, unless it is empty.
+static void take_field_text (struct feed_parser* p, char** pd)
+{
+    if (!p->textlen)
+	return; // don't overwrite with empty
+    free (*pd);
+    *pd = strndup (p->text, p->textlen);
+    CleanupString (*pd, p->fullclean);
+}
 
-	// Userland extensions (No namespace!)
-	else if (node_name_is (cur, "guid"))
-	    copy_node_text_to (doc, cur, &guid, true);
-	else if (node_name_is (cur, "pubDate"))
-	    item->data->date = pubDate_from_node_text (doc, cur);
-	else if (node_name_is (cur, "readstatus"))
-	    item->data->readstatus = number_from_node_text (doc, cur);
+// Same for item fields, which are allocated in the feed's item arena.
+// The replaced text stays in the arena until the next parse.
+static void take_item_text (struct feed_parser* p, char** pd)
+{
+    if (!p->textlen)
+	return;
+    *pd = ArenaStrndup (p->feed->itemarena, p->text, p->textlen);
+    CleanupString (*pd, p->fullclean);
+}
 
-	// content:encoded
-	else if (node_ns_name_is (cur, contentNs, "encoded"))
-	    copy_node_text_to (doc, cur, &item->data->description, false);
+// Returns the field text as a temporary string, NULL if empty.
+static const char* field_text (struct feed_parser* p)
+{
+    if (!p->textlen)
+	return NULL;
+    CleanupString (p->text, p->fullclean);
+    return p->text;
+}
 
-	// Dublin Core dc:date
-	else if (node_ns_name_is (cur, dcNs, "date"))
-	    item->data->date = ISODate_from_node_text (doc, cur);
+//}}}-------------------------------------------------------------------
+//{{{ Items
 
-	// Using snow namespace
-	else if (node_ns_name_is (cur, snowNs, "hash"))
-	    copy_node_text_to (doc, cur, &item->data->hash, true);
-	else if (node_ns_name_is (cur, snowNs, "date"))
-	    item->data->date = number_from_node_text (doc, cur);
-    }
+static void start_item (struct feed_parser* p)
+{
+    // Reserve memory for a new news item
+    if (!p->feed->itemarena)
+	p->feed->itemarena = NewArena();
+    struct newsitem* item = ArenaAlloc (p->feed->itemarena, sizeof (struct newsitem));
+    *item = (struct newsitem){};
+    item->data = ArenaAlloc (p->feed->itemarena, sizeof (struct newsdata));
+    *item->data = (struct newsdata){ .parent = p->feed };
+    p->item = item;
+    p->itemdepth = p->depth;
+}
+
+// Called when the </item> or </entry> tag is reached.
+static void end_item (struct feed_parser* p)
+{
+    struct feed* feed = p->feed;
+    struct newsitem* item = p->item;
+    p->item = NULL;
+    p->itemdepth = 0;
 
     // If we have loaded the hash from disk cache, don't regenerate it.
     // <guid> is not saved in the cache, thus we would generate a different
     // hash than the one from the live feed.
     if (!item->data->hash) {
-	const char* hashitems[] = { item->data->title, item->data->link, guid, NULL };
-	item->data->hash = genItemHash (hashitems, 3);
+	const char* hashitems[] = { item->data->title, item->data->link, p->guid, NULL };
+	char* hash = genItemHash (hashitems, 3);
+	item->data->hash = ArenaStrdup (feed->itemarena, hash);
+	free (hash);
     }
     if (!item->data->title)
-	item->data->title = strdup ("Untitled");
-    if (guid) {
-	xmlFree (guid);
-	guid = NULL;
-    }
+	item->data->title = ArenaStrdup (feed->itemarena, "Untitled");
+    free (p->guid);
+    p->guid = NULL;
 
-    // If saverestore == true, restore readstatus.
-    if (saverestore) {
-	for (struct newsitem* i = firstcopy; i; i = i->next) {
-	    if (strcmp (item->data->hash, i->data->hash) == 0) {
-		item->data->readstatus = i->data->readstatus;
-		break;
-	    }
-	}
-    }
+    // Restore readstatus if the item was there before the reparse
+    readstatus_set_restore (&p->oldstatus, item);
 
-    if (!feed->items)
+    if (!p->lastitem)	// Only walk the list once, if it is not empty
+	for (p->lastitem = feed->items; p->lastitem && p->lastitem->next; p->lastitem = p->lastitem->next) {}
+    if (!p->lastitem)
 	feed->items = item;
     else {
-	item->prev = feed->items;
-	while (item->prev->next)
-	    item->prev = item->prev->next;
-	item->prev->next = item;
+	item->prev = p->lastitem;
+	p->lastitem->next = item;
     }
+    p->lastitem = item;
 }
 
-// Called during parsing, if we look for a <channel> element
-// The function returns a new struct for the newsfeed.
-
-static void parse_rdf10_channel (struct feed* feed, xmlDocPtr doc, xmlNodePtr node)
+// Determines what to read from an element inside <item> or <entry>
+static enum EFeedField item_field (struct feed_parser* p, enum EElement elem, const xmlChar* uri, int nattrs, const xmlChar** attrs)
 {
-    // Free everything before we write to it again.
-    free_feed (feed);
-    // Go through all the tags in the <channel> tag and extract the information
-    for (xmlNodePtr cur = node; cur; cur = cur->next) {
-	if (cur->type != XML_ELEMENT_NODE)
-	    continue;
-	if (node_name_is (cur, "title"))
-	    copy_node_text_to (doc, cur, &feed->title, true);
-	else if (node_name_is (cur, "link"))
-	    copy_node_text_to (doc, cur, &feed->link, false);
-	else if (node_name_is (cur, "description"))
-	    copy_node_text_to (doc, cur, &feed->description, false);
+    if (p->format == format_atom) {
+	switch (elem) {
+	    case elem_title:
+		p->fullclean = true;
+		return field_item_title;
+	    case elem_link: {
+		char* rel = attribute_value (nattrs, attrs, "rel");
+		if (!rel || 0 == strcmp (rel, "alternate")) {
+		    char* href = attribute_value (nattrs, attrs, "href");
+		    p->item->data->link = href ? ArenaStrdup (p->feed->itemarena, href) : NULL;
+		    CleanupString (p->item->data->link, false);
+		    free (href);
+		}
+		free (rel);
+		return field_none; }
+	    case elem_summary:	return p->item->data->description ? field_none : field_item_summary;
+	    case elem_content:	return field_item_description;
+	    case elem_id:	return field_item_guid;
+	    case elem_updated:	return field_item_isodate;
+	    default:		return field_none;
+	}
     }
-}
 
-//}}}-------------------------------------------------------------------
-//{{{ RSS 2 parsing
+    switch (elem) {
+	// Basic RSS
+	case elem_title:
+	    p->fullclean = true;
+	    return field_item_title;
+	case elem_link:		return field_item_link;
+	case elem_description:	return field_item_description;
 
-static void parse_rdf20_channel (struct feed* feed, xmlDocPtr doc, xmlNodePtr node)
-{
-    // Free everything before we write to it again.
-    free_feed (feed);
-    // Go through all the tags in the <channel> tag and extract the information
-    for (xmlNodePtr cur = node; cur; cur = cur->next) {
-	if (cur->type != XML_ELEMENT_NODE)
-	    continue;
-	if (node_name_is (cur, "title"))
-	    copy_node_text_to (doc, cur, &feed->title, true);
-	else if (node_name_is (cur, "link"))
-	    copy_node_text_to (doc, cur, &feed->link, false);
-	else if (node_name_is (cur, "description"))
-	    copy_node_text_to (doc, cur, &feed->description, false);
-	else if (node_name_is (cur, "item"))
-	    parse_rdf10_item (feed, doc, cur->children);
+	// Userland extensions (No namespace!)
+	case elem_guid:
+	    p->fullclean = true;
+	    return field_item_guid;
+	case elem_pubDate:	return field_item_pubdate;
+	case elem_readstatus:	return field_item_readstatus;
+	default:		break;
     }
-}
 
-//}}}-------------------------------------------------------------------
-//{{{ Atom parsing
+    switch (namespace_id (&p->names, uri)) {
+	// content:encoded
+	case ns_content:
+	    return elem == elem_encoded ? field_item_description : field_none;
 
-static void parse_atom_entry (struct feed* feed, xmlDocPtr doc, xmlNodePtr node)
-{
-    // Reserve memory for a new news item
-    struct newsitem* item = calloc (1, sizeof (struct newsitem));
-    item->data = calloc (1, sizeof (struct newsdata));
-    item->data->parent = feed;
+	// Dublin Core dc:date
+	case ns_dc:
+	    return elem == elem_date ? field_item_isodate : field_none;
 
-    char* guid = NULL;
+	// Using snow namespace
+	case ns_snow:
+	    if (elem == elem_hash) {
+		p->fullclean = true;
+		return field_item_hash;
+	    }
+	    return elem == elem_date ? field_item_date : field_none;
+	default:
+	    return field_none;
+    }
+}
 
-    // Go through all the tags in the <item> tag and extract the information.
-    // same procedure as in the parse_channel() function
-    for (xmlNodePtr cur = node; cur != NULL; cur = cur->next) {
-	if (cur->type != XML_ELEMENT_NODE)
-	    continue;
+//}}}-------------------------------------------------------------------
+//{{{ SAX callbacks
 
-	if (node_name_is (cur, "title"))
-	    copy_node_text_to (doc, cur, &item->data->title, true);
-	else if (node_name_is (cur, "link")) {
-	    char* rel = NULL;
-	    copy_node_prop_to (cur, "rel", &rel, false );
-	    if (!rel || 0 == strcmp (rel, "alternate"))
-		copy_node_prop_to (cur, "href", &item->data->link, false);
-	    free (rel);
-	} else if (node_name_is (cur, "summary") && !item->data->description)
-	    copy_node_text_to (doc, cur, &item->data->description, false);
-	else if (node_name_is (cur, "content"))
-	    copy_node_text_to (doc, cur, &item->data->description, false);
-	else if (node_name_is (cur, "id"))
-	    copy_node_text_to (doc, cur, &guid, false);
-	else if (node_name_is (cur, "updated"))
-	    item->data->date = ISODate_from_node_text (doc, cur);
-    }
+static void start_channel (struct feed_parser* p)
+{
+    // Free everything before we write to it again.
+    free_feed (p->feed);
+    p->lastitem = NULL;
+    p->channeldepth = p->depth;
+}
 
-    // If we have loaded the hash from disk cache, don't regenerate it.
-    // <guid> is not saved in the cache, thus we would generate a different
-    // hash than the one from the live feed.
-    if (!item->data->hash) {
-	const char* hashitems[] = { item->data->title, item->data->link, guid, NULL };
-	item->data->hash = genItemHash (hashitems, 3);
-    }
-    if (!item->data->title)
-	item->data->title = strdup ("Untitled");
-    if (guid) {
-	free (guid);
-	guid = NULL;
+// Decides the feed format from the root element.
+static void start_root (struct feed_parser* p, enum EElement elem)
+{
+    if (elem == elem_RDF)
+	p->format = format_rdf;
+    else if (elem == elem_rss)
+	p->format = format_rss;
+    else if (elem == elem_feed) {
+	p->format = format_atom;
+	start_channel (p);
+    } else {
+	p->format = format_unknown;
+	xmlStopParser (p->ctxt);
     }
+}
 
-    // If saverestore == true, restore readstatus.
-    if (saverestore) {
-	for (const struct newsitem* i = firstcopy; i; i = i->next) {
-	    if (strcmp (item->data->hash, i->data->hash) == 0) {
-		item->data->readstatus = i->data->readstatus;
+static void on_start_element (void* vp, const xmlChar* name, const xmlChar* prefix __attribute__((unused)), const xmlChar* uri,
+	int nns __attribute__((unused)), const xmlChar** ns __attribute__((unused)),
+	int nattrs, int ndefaulted __attribute__((unused)), const xmlChar** attrs)
+{
+    struct feed_parser* p = vp;
+    if (++p->depth == 1)
+	return start_root (p, element_id (&p->names, name));
+    if (p->fielddepth)
+	return;	// Markup inside a field is skipped
+    enum EElement elem = element_id (&p->names, name);
+
+    enum EFeedField field = field_none;
+    p->fullclean = false;
+    if (p->item) {
+	if (p->depth == p->itemdepth + 1)
+	    field = item_field (p, elem, uri, nattrs, attrs);
+    } else if (p->channeldepth && p->depth == p->channeldepth + 1) {
+	// Elements directly inside <channel>, or inside <feed> for Atom
+	switch (elem) {
+	    case elem_title:
+		p->fullclean = true;
+		field = field_channel_title;
+		break;
+	    case elem_link:
+		if (p->format != format_atom)
+		    field = field_channel_link;
+		else {
+		    free (p->feed->link);
+		    p->feed->link = attribute_value (nattrs, attrs, "href");
+		    CleanupString (p->feed->link, false);
+		}
+		break;
+	    case elem_description:
+		if (p->format != format_atom)
+		    field = field_channel_description;
+		break;
+	    case elem_ttl:
+		if (p->format == format_rss)
+		    field = field_channel_ttl;
+		break;
+	    case elem_updatePeriod:
+		if (namespace_id (&p->names, uri) == ns_sy)
+		    field = field_channel_update_period;
+		break;
+	    case elem_updateFrequency:
+		if (namespace_id (&p->names, uri) == ns_sy)
+		    field = field_channel_update_frequency;
+		break;
+	    case elem_item:
+		if (p->format == format_rss)
+		    start_item (p);
+		break;
+	    case elem_entry:
+		if (p->format == format_atom)
+		    start_item (p);
+		break;
+	    default:
 		break;
+	}
+    } else if (p->depth == 2) {
+	// Elements directly inside the root
+	if (elem == elem_channel)
+	    start_channel (p);
+	else if (p->format == format_rdf) {
+	    if (elem == elem_item)
+		start_item (p);
+	    // Last-Modified and ETag are only used when reading from internal feeds (disk cache).
+	    else if (namespace_id (&p->names, uri) == ns_snow) {
+		if (elem == elem_lastmodified)
+		    field = field_lastmodified;
+		else if (elem == elem_etag)
+		    field = field_etag;
+		else if (elem == elem_digest)
+		    field = field_digest;
 	    }
 	}
     }
+    if (field != field_none) {
+	p->field = field;
+	p->fielddepth = p->depth;
+	p->textlen = 0;
+    }
+}
 
-    if (!feed->items)
-	feed->items = item;
-    else {
-	item->prev = feed->items;
-	while (item->prev->next)
-	    item->prev = item->prev->next;
-	item->prev->next = item;
+// Converts sy:updatePeriod to seconds
+static unsigned update_period_seconds (const char* period)
+{
+    static const struct {
+	char name [8];
+	unsigned seconds;
+    } c_periods[] = {
+	{ "hourly",	60*60 },
+	{ "daily",	24*60*60 },
+	{ "weekly",	7*24*60*60 },
+	{ "monthly",	30*24*60*60 },
+	{ "yearly",	365*24*60*60 }
+    };
+    for (unsigned i = 0; period && i < sizeof(c_periods)/sizeof(c_periods[0]); ++i)
+	if (0 == strcmp (period, c_periods[i].name))
+	    return c_periods[i].seconds;
+    return 0;
+}
+
+static void end_field (struct feed_parser* p)
+{
+    struct feed* feed = p->feed;
+    struct newsdata* data = p->item ? p->item->data : NULL;
+    switch (p->field) {
+	case field_channel_title:	take_field_text (p, &feed->title); break;
+	case field_channel_link:	take_field_text (p, &feed->link); break;
+	case field_channel_description:	take_field_text (p, &feed->description); break;
+	case field_channel_ttl:		p->ttl = p->textlen ? atol (field_text (p)) : 0; break;
+	case field_channel_update_period: p->updateperiod = update_period_seconds (field_text (p)); break;
+	case field_channel_update_frequency: p->updatefrequency = p->textlen ? atol (field_text (p)) : 0; break;
+	case field_item_title:		take_item_text (p, &data->title); break;
+	case field_item_link:		take_item_text (p, &data->link); break;
+	case field_item_summary:
+	case field_item_description:	take_item_text (p, &data->description); break;
+	case field_item_guid:		take_field_text (p, &p->guid); break;
+	case field_item_hash:		take_item_text (p, &data->hash); break;
+	case field_item_pubdate:	data->date = pubDateToUnix (field_text (p)); break;
+	case field_item_isodate:	data->date = ISODateToUnix (field_text (p)); break;
+	case field_item_date:		data->date = p->textlen ? atol (field_text (p)) : 0; break;
+	case field_item_readstatus:	data->readstatus = p->textlen ? atol (field_text (p)) : 0; break;
+	case field_lastmodified:	feed->lastmodified = p->textlen ? atol (field_text (p)) : 0; break;
+	case field_etag:		take_field_text (p, &feed->etag); break;
+	case field_digest:		feed->digest = p->textlen ? strtoull (field_text (p), NULL, 16) : 0; break;
+	default: break;
     }
+    p->field = field_none;
+    p->fielddepth = 0;
+    p->textlen = 0;
 }
 
-static void parse_atom_channel (struct feed* feed, xmlDocPtr doc, xmlNodePtr node)
+static void on_end_element (void* vp, const xmlChar* name __attribute__((unused)),
+	const xmlChar* prefix __attribute__((unused)), const xmlChar* uri __attribute__((unused)))
 {
-    // Free everything before we write to it again.
-    free_feed (feed);
-    // Go through all the tags in the <channel> tag and extract the information
-    for (xmlNodePtr cur = node; cur; cur = cur->next) {
-	if (cur->type != XML_ELEMENT_NODE)
-	    continue;
-	if (node_name_is (cur, "title"))
-	    copy_node_text_to (doc, cur, &feed->title, true);
-	else if (node_name_is (cur, "link"))
-	    copy_node_prop_to (cur, "href", &feed->link, false);
-	else if (node_name_is (cur, "entry"))
-	    parse_atom_entry (feed, doc, cur->children);
+    struct feed_parser* p = vp;
+    if (p->fielddepth == p->depth)
+	end_field (p);
+    else if (p->item && p->itemdepth == p->depth)
+	end_item (p);
+    else if (p->channeldepth == p->depth)
+	p->channeldepth = 0;
+    --p->depth;
+}
+
+// Collects text and CDATA directly inside the field element
+static void on_characters (void* vp, const xmlChar* text, int len)
+{
+    struct feed_parser* p = vp;
+    if (!p->fielddepth || p->fielddepth != p->depth)
+	return;
+    if (p->textlen + len + 1 > p->textcap) {
+	size_t newcap = p->textcap ? 2 * p->textcap : 256;
+	while (newcap < p->textlen + len + 1)
+	    newcap *= 2;
+	char* newtext = realloc (p->text, newcap);
+	if (!newtext)
+	    return;
+	p->text = newtext;
+	p->textcap = newcap;
     }
+    memcpy (&p->text[p->textlen], text, len);
+    p->textlen += len;
+    p->text[p->textlen] = 0;
 }
 
 //}}}-------------------------------------------------------------------
+//{{{ Parser interface
 
-int DeXML (struct feed* cur_ptr)
+// Creates a parser that will store the feed read from it in feed.
+struct feed_parser* NewFeedParser (struct feed* feed)
 {
-    if (!cur_ptr->xmltext)
-	return -1;
-
-    saverestore = false;
-    // If cur_ptr-> items! = NULL then we can cache item->readstatus
-    if (cur_ptr->items != NULL) {
-	saverestore = true;
-	firstcopy = NULL;
-
-	// Copy current newsitem struct. */
-	for (struct newsitem * cur_item = cur_ptr->items; cur_item != NULL; cur_item = cur_item->next) {
-	    copy = calloc (1, sizeof (struct newsitem));
-	    copy->data = calloc (1, sizeof (struct newsdata));
-	    copy->data->readstatus = cur_item->data->readstatus;
-	    if (cur_item->data->hash)
-		copy->data->hash = strdup (cur_item->data->hash);
-
-	    copy->next = NULL;
-	    if (!firstcopy) {
-		copy->prev = NULL;
-		firstcopy = copy;
-	    } else {
-		copy->prev = firstcopy;
-		while (copy->prev->next)
-		    copy->prev = copy->prev->next;
-		copy->prev->next = copy;
-	    }
-	}
-    }
-    // xmlRecoverMemory:
-    // parse an XML in-memory document and build a tree.
-    // In case the document is not Well Formed, a tree is built anyway.
-    xmlDocPtr doc = xmlRecoverMemory (cur_ptr->xmltext, strlen (cur_ptr->xmltext));
-    if (!doc)
-	return 2;
+    struct feed_parser* p = calloc (1, sizeof (struct feed_parser));
+    if (!p)
+	return NULL;
+    p->feed = feed;
+
+    // Remember item->readstatus to restore it after the reparse
+    readstatus_set_init (&p->oldstatus, feed->items);
+    return p;
+}
 
-    // Find the root element (in our case, it should read "<RDF: RDF>").
-    // The RDF: prefix is ignored for now until the Jaguar
-    // Find out how to read that exactly (jau).
-    xmlNodePtr cur = xmlDocGetRootElement (doc);
-    if (!cur) {
-	xmlFreeDoc (doc);
-	return 2;
+// Parses the next piece of feed text. The first piece should
+// contain the beginning of the document to detect its encoding.
+int FeedParserChunk (struct feed_parser* p, const char* text, size_t size)
+{
+    if (!p->ctxt) {
+	static const xmlSAXHandler c_handler = {
+	    .initialized = XML_SAX2_MAGIC,
+	    .startElementNs = on_start_element,
+	    .endElementNs = on_end_element,
+	    .characters = on_characters,
+	    .ignorableWhitespace = on_characters,
+	    .cdataBlock = on_characters
+	};
+	// The first four bytes are used to detect the document encoding
+	int headsz = size < 4 ? size : 4;
+	p->ctxt = xmlCreatePushParserCtxt ((xmlSAXHandlerPtr) &c_handler, p, text, headsz, NULL);
+	if (!p->ctxt)
+	    return -1;
+	intern_element_names (&p->names, p->ctxt->dict);
+	// Like xmlRecoverMemory, read as much as possible from broken feeds.
+	xmlCtxtUseOptions (p->ctxt, XML_PARSE_RECOVER | XML_PARSE_NONET);
+	text += headsz;
+	size -= headsz;
     }
-    // Check if the element really is called <RDF>
-    if (node_name_is (cur, "RDF")) {
-	// Now we go through all the elements in the document. This loop however,
-	// only the highest level elements work (HTML would only be HEAD and
-	// BODY), so do not wander entire structure down through. The functions
-	// are responsible for this, which we then call in the loop itself.
-	for (xmlNodePtr c = cur->children; c; c = c->next) {
-	    if (c->type != XML_ELEMENT_NODE)
-		continue;
-	    if (node_name_is (c, "channel"))
-		parse_rdf10_channel (cur_ptr, doc, c->children);
-	    if (node_name_is (c, "item"))
-		parse_rdf10_item (cur_ptr, doc, c->children);
-	    // Last-Modified is only used when reading from internal feeds (disk cache).
-	    if (node_ns_name_is (c, snowNs, "lastmodified"))
-		cur_ptr->lastmodified = number_from_node_text (doc, c);
-	}
-    } else if (node_name_is (cur, "rss")) {
-	for (xmlNodePtr c = cur->children; c; c = c->next) {
-	    if (c->type != XML_ELEMENT_NODE)
-		continue;
-	    if (node_name_is (c, "channel"))
-		parse_rdf20_channel (cur_ptr, doc, c->children);
-	}
-    } else if (node_name_is (cur, "feed")) {
-	parse_atom_channel (cur_ptr, doc, cur->children);
-    } else {
-	xmlFreeDoc (doc);
-	return 3;
+    while (size && p->ctxt->instate != XML_PARSER_EOF) {
+	int chunksz = size > INT_MAX ? INT_MAX : size;
+	xmlParseChunk (p->ctxt, text, chunksz, false);
+	text += chunksz;
+	size -= chunksz;
     }
+    return 0;
+}
 
-    xmlFreeDoc (doc);
-
-    if (saverestore) {
-	// free struct newsitem *copy.
-	while (firstcopy->next) {
-	    firstcopy = firstcopy->next;
-	    free (firstcopy->prev->data->hash);
-	    free (firstcopy->prev->data);
-	    free (firstcopy->prev);
-	}
-	free (firstcopy->data->hash);
-	free (firstcopy->data);
-	free (firstcopy);
-	firstcopy = NULL;
+// Finishes parsing and frees the parser.
+// Returns 0 on success, 2 if no document was found, and
+// 3 if the document was not a recognized feed format.
+int FinishFeedParser (struct feed_parser* p)
+{
+    if (p->ctxt && p->ctxt->instate != XML_PARSER_EOF)
+	xmlParseChunk (p->ctxt, NULL, 0, true);
+
+    // Close an item left open by a truncated feed, like
+    // the tree built by xmlRecoverMemory would have done.
+    if (p->fielddepth)
+	end_field (p);
+    if (p->item)
+	end_item (p);
+
+    int rc = 0;
+    if (p->format == format_none)
+	rc = 2;
+    else if (p->format == format_unknown)
+	rc = 3;
+
+    // The refresh interval requested by the feed, in seconds.
+    // The syndication module defaults to daily updates.
+    unsigned ttl = p->ttl * 60;
+    if (p->updateperiod || p->updatefrequency) {
+	unsigned period = p->updateperiod ? p->updateperiod : 24*60*60;
+	unsigned syttl = period / (p->updatefrequency ? p->updatefrequency : 1);
+	if (syttl > ttl)
+	    ttl = syttl;
     }
 
+    if (p->ctxt)
+	xmlFreeParserCtxt (p->ctxt);
+    free (p->text);
+    free (p->guid);
+    free (p->oldstatus.entries);
+    struct feed* cur_ptr = p->feed;
+    free (p);
+    if (rc)
+	return rc;
+    cur_ptr->ttl = ttl;
+
     if (cur_ptr->custom_title) {
 	free (cur_ptr->title);
 	cur_ptr->title = strdup (cur_ptr->custom_title);
@@ -458,6 +778,19 @@ int DeXML (struct feed* cur_ptr)
     return 0;
 }
 
+//}}}-------------------------------------------------------------------
+
+int DeXML (struct feed* cur_ptr)
+{
+    if (!cur_ptr->xmltext)
+	return -1;
+    struct feed_parser* p = NewFeedParser (cur_ptr);
+    if (!p)
+	return 2;
+    FeedParserChunk (p, cur_ptr->xmltext, cur_ptr->content_length);
+    return FinishFeedParser (p);
+}
+
 unsigned ParseOPMLFile (const char* flbuf)
 {
     unsigned nfeeds = 0;
@@ -484,7 +817,8 @@ unsigned ParseOPMLFile (const char* flbuf)
 		copy_node_prop_to (outline, "category", &categories, false);
 		copy_node_prop_to (outline, "filter", &filter, false);
 
-		if (xmlUrl && text) {
+		// Feeds that were never loaded are saved without a title
+		if (xmlUrl) {
 		    AddFeed (xmlUrl, text, categories, filter);
 		    ++nfeeds;
 		}
@@ -17,5 +17,9 @@
 #pragma once
 #include "main.h"
 
+struct feed_parser;
+struct feed_parser* NewFeedParser (struct feed* feed);
+int FeedParserChunk (struct feed_parser* p, const char* text, size_t size);
+int FinishFeedParser (struct feed_parser* p);
 int DeXML (struct feed* cur_ptr);
 unsigned ParseOPMLFile (const char* flbuf);
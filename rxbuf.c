@@ -0,0 +1,123 @@
+// This file is part of Snownews - A lightweight console RSS newsreader
+//
+// Copyright (c) 2021 Mike Sharov <msharov@users.sourceforge.net>
+//
+// Snownews is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 3
+// as published by the Free Software Foundation.
+//
+// Snownews is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Snownews. If not, see http://www.gnu.org/licenses/.
+
+#include "rxbuf.h"
+
+enum {
+    RXBUF_MIN_SIZE = 16*1024,	// Smallest buffer allocated
+    RXBUF_POOL_SIZE = 16	// Released buffers kept
+};
+
+struct rxbuf {
+    char* data;
+    unsigned capacity;
+};
+
+static struct rxbuf s_pool [RXBUF_POOL_SIZE] = {};
+static unsigned s_npooled = 0;
+static struct rxbuf_stats s_stats = {};
+
+// Takes the smallest pooled buffer holding need bytes
+static bool TakePooledBuffer (char** pbuf, unsigned* pcapacity, size_t need)
+{
+    unsigned best = s_npooled;
+    for (unsigned i = 0; i < s_npooled; ++i)
+	if (s_pool[i].capacity >= need && (best >= s_npooled || s_pool[i].capacity < s_pool[best].capacity))
+	    best = i;
+    if (best >= s_npooled)
+	return false;
+    *pbuf = s_pool[best].data;
+    *pcapacity = s_pool[best].capacity;
+    s_pool[best] = s_pool[--s_npooled];
+    ++s_stats.reuses;
+    return true;
+}
+
+// Makes the buffer at *pbuf, holding size bytes, hold at least need.
+// The buffer may be NULL. Returns false if out of memory.
+bool RxBufReserve (char** pbuf, unsigned* pcapacity, unsigned size, size_t need)
+{
+    if (*pbuf && need <= *pcapacity)
+	return true;
+    if (need > UINT_MAX)
+	return false;
+    if (!*pbuf) {
+	*pcapacity = 0;
+	if (TakePooledBuffer (pbuf, pcapacity, need))
+	    return true;
+    }
+    // When the length is not known in advance, doubling
+    // keeps the total copied less than the final length.
+    size_t newcap = *pbuf ? 2 * (size_t) *pcapacity : RXBUF_MIN_SIZE;
+    if (newcap < need)
+	newcap = need;
+    if (newcap > UINT_MAX)
+	newcap = UINT_MAX;
+    char* newbuf = realloc (*pbuf, newcap);
+    if (!newbuf)
+	return false;
+    if (*pbuf) {
+	++s_stats.grows;
+	s_stats.copied += size;
+    } else
+	++s_stats.allocs;
+    s_stats.allocated += newcap;
+    *pbuf = newbuf;
+    *pcapacity = newcap;
+    return true;
+}
+
+// Returns the buffer to the pool, or frees it if the pool is full
+// of larger buffers. Sets *pbuf to NULL.
+void RxBufRelease (char** pbuf, unsigned* pcapacity)
+{
+    struct rxbuf b = { *pbuf, *pcapacity };
+    *pbuf = NULL;
+    *pcapacity = 0;
+    if (!b.data)
+	return;
+    if (s_npooled < RXBUF_POOL_SIZE) {
+	s_pool[s_npooled++] = b;
+	return;
+    }
+    unsigned smallest = 0;
+    for (unsigned i = 1; i < s_npooled; ++i)
+	if (s_pool[i].capacity < s_pool[smallest].capacity)
+	    smallest = i;
+    if (s_pool[smallest].capacity < b.capacity) {
+	struct rxbuf t = s_pool[smallest];
+	s_pool[smallest] = b;
+	b = t;
+    }
+    free (b.data);
+}
+
+// Frees the pooled buffers
+void RxBufTrim (void)
+{
+    while (s_npooled)
+	free (s_pool[--s_npooled].data);
+}
+
+const struct rxbuf_stats* RxBufStats (void)
+{
+    return &s_stats;
+}
+
+void RxBufResetStats (void)
+{
+    memset (&s_stats, 0, sizeof (s_stats));
+}
@@ -0,0 +1,36 @@
+// This file is part of Snownews - A lightweight console RSS newsreader
+//
+// Copyright (c) 2021 Mike Sharov <msharov@users.sourceforge.net>
+//
+// Snownews is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 3
+// as published by the Free Software Foundation.
+//
+// Snownews is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Snownews. If not, see http://www.gnu.org/licenses/.
+
+#pragma once
+#include "main.h"
+
+// Buffers receiving feed text. A buffer is sized for the expected length
+// when it is known, and otherwise grows geometrically. Released buffers
+// are kept for the next feeds until RxBufTrim, called after a refresh.
+// Used only on the main thread.
+struct rxbuf_stats {
+    unsigned allocs;		// Buffers allocated
+    unsigned reuses;		// Buffers taken from the pool
+    unsigned grows;		// Buffers enlarged
+    uint64_t allocated;		// Bytes allocated by allocs and grows
+    uint64_t copied;		// Bytes of contents moved by grows
+};
+
+bool RxBufReserve (char** pbuf, unsigned* pcapacity, unsigned size, size_t need);
+void RxBufRelease (char** pbuf, unsigned* pcapacity);
+void RxBufTrim (void);
+const struct rxbuf_stats* RxBufStats (void);
+void RxBufResetStats (void);
@@ -61,17 +61,18 @@ static char* LoadFile (const char* filename)
     int fd = open (filename, O_RDONLY);
     if (fd < 0)
 	return NULL;
-    char* r = calloc (1, st.st_size);
-    for (ssize_t br = 0; br < st.st_size;) {
+    char* r = calloc (1, st.st_size + 1);	// With a terminating zero
+    for (ssize_t br = 0; r && br < st.st_size;) {
 	ssize_t ec = read (fd, &r[br], st.st_size-br);
 	if (ec <= 0) {
-	    if (errno == EINTR)
+	    if (ec < 0 && errno == EINTR)
 		continue;
 	    free (r);
-	    return NULL;
-	}
-	br += ec;
+	    r = NULL;
+	} else
+	    br += ec;
     }
+    close (fd);
     return r;
 }
 
@@ -209,6 +210,8 @@ static void SetupKeybindings (const char* filename)
 		_settings.keybindings.newheadlines = value[0];
 	    else if (strcmp (linebuf, "type ahead find") == 0)
 		_settings.keybindings.typeahead = value[0];
+	    else if (strcmp (linebuf, "cancel refresh") == 0)
+		_settings.keybindings.cancelrefresh = value[0];
 	}
 	// Override old default settings and make sure there is no clash.
 	// Default browser is now B; b moved to page up.
@@ -223,6 +226,7 @@ static void SetupKeybindings (const char* filename)
 	fprintf (configfile, "add feed:%c\n", _settings.keybindings.addfeed);
 	fprintf (configfile, "delete feed:%c\n", _settings.keybindings.deletefeed);
 	fprintf (configfile, "reload all feeds:%c\n", _settings.keybindings.reloadall);
+	fprintf (configfile, "cancel refresh:%c\n", _settings.keybindings.cancelrefresh);
 	fprintf (configfile, "change default browser:%c\n", _settings.keybindings.dfltbrowser);
 	fprintf (configfile, "move item up:%c\n", _settings.keybindings.moveup);
 	fprintf (configfile, "move item down:%c\n", _settings.keybindings.movedown);
@@ -319,7 +323,7 @@ static void SetupColors (const char* filename)
 	fprintf (configfile, "feedtitle:%d\n", _settings.color.feedtitle);
 	fclose (configfile);
     }
-    if (!_settings.monochrome) {
+    if (!_settings.monochrome && !_settings.headless) {
 	start_color();
 
 	// The following call will automagically implement -1 as the terminal's
@@ -347,6 +351,58 @@ static void SetupColors (const char* filename)
 
 }
 
+// Load network settings, writing the defaults if there is no file.
+static void SetupNetwork (const char* filename)
+{
+    FILE* configfile = fopen (filename, "r");
+    if (configfile) {
+	while (!feof (configfile)) {
+	    char linebuf[128];
+	    if (!fgets (linebuf, sizeof (linebuf), configfile))
+		break;
+	    if (linebuf[0] == '#')
+		continue;
+	    linebuf[strlen (linebuf) - 1] = 0;	// chop newline
+	    char* value = linebuf;
+	    strsep (&value, ":");
+	    if (!value)
+		continue;
+	    unsigned nval = atoi (value);
+	    if (strcmp (linebuf, "parallel downloads") == 0)
+		_settings.maxdownloads = nval ? nval : 1;
+	    else if (strcmp (linebuf, "connections per host") == 0)
+		_settings.hostconnections = nval;
+	    else if (strcmp (linebuf, "automatic refresh") == 0)
+		_settings.autorefresh = nval;
+	    else if (strcmp (linebuf, "download rate limit") == 0)
+		_settings.maxrate = nval;
+	    else if (strcmp (linebuf, "feed timeout") == 0)
+		_settings.feedtimeout = nval;
+	    else if (strcmp (linebuf, "refresh timeout") == 0)
+		_settings.refreshtimeout = nval;
+	}
+	fclose (configfile);
+    } else {
+	configfile = fopen (filename, "w");
+	if (!configfile)
+	    return;
+	fputs ("# Snownews network settings\n", configfile);
+	fputs ("# Number of feeds to download at the same time\n", configfile);
+	fprintf (configfile, "parallel downloads:%hu\n", _settings.maxdownloads);
+	fputs ("# Maximum connections to one server, 0 for unlimited\n", configfile);
+	fprintf (configfile, "connections per host:%hu\n", _settings.hostconnections);
+	fputs ("# Refresh each feed in the background when it is due, 1 to enable\n", configfile);
+	fprintf (configfile, "automatic refresh:%u\n", _settings.autorefresh);
+	fputs ("# Total download rate of all feeds in KB/s, 0 for unlimited\n", configfile);
+	fprintf (configfile, "download rate limit:%u\n", _settings.maxrate);
+	fputs ("# Seconds to wait for one feed to download, 0 for no limit\n", configfile);
+	fprintf (configfile, "feed timeout:%u\n", _settings.feedtimeout);
+	fputs ("# Seconds to wait for all feeds to refresh, 0 for no limit\n", configfile);
+	fprintf (configfile, "refresh timeout:%u\n", _settings.refreshtimeout);
+	fclose (configfile);
+    }
+}
+
 // Load user customized entity conversion table.
 static void SetupEntities (const char* file)
 {
@@ -510,6 +566,9 @@ unsigned Config (void)
     ConfigFilePath ("colors", filename, sizeof(filename));
     SetupColors (filename);
 
+    ConfigFilePath ("network", filename, sizeof(filename));
+    SetupNetwork (filename);
+
     ConfigFilePath ("html_entities", filename, sizeof(filename));
     SetupEntities (filename);
 
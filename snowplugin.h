@@ -0,0 +1,45 @@
+// This file is part of Snownews - A lightweight console RSS newsreader
+//
+// Copyright (c) 2021 Mike Sharov <msharov@users.sourceforge.net>
+//
+// Snownews is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 3
+// as published by the Free Software Foundation.
+//
+// Snownews is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty
+// of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Snownews. If not, see http://www.gnu.org/licenses/.
+
+#pragma once
+#include <stddef.h>
+
+// Filter plugin interface.
+//
+// A filter plugin is a shared object used by feeds with the filter
+// "plugin:/path/to/filter.so". It is loaded once and called on the main
+// thread for every feed using it, with the downloaded text, which is
+// zero-terminated. The converted feed is written into the output buffer,
+// owned by snownews. A plugin runs inside snownews, so a crash in it
+// takes snownews down with it. See docs/filters/identity.c.
+
+enum { SNOWNEWS_FILTER_ABI = 1 };
+
+struct snownews_filter_out {
+    char*	data;	// The converted feed
+    size_t	size;	// Bytes written to data
+    // Returns room for at least n more bytes at data + size,
+    // or NULL if out of memory. May move data.
+    char*	(*reserve)(struct snownews_filter_out* out, size_t n);
+};
+
+// Exported by the plugin, set to SNOWNEWS_FILTER_ABI
+#define SNOWNEWS_FILTER_PLUGIN	const unsigned snownews_filter_abi = SNOWNEWS_FILTER_ABI
+
+// Exported by the plugin. Converts insize bytes of in, appending the
+// result to out. Returns 0 on success, nonzero if the feed is invalid.
+typedef int (*snownews_filter_transform_t)(const char* in, size_t insize, struct snownews_filter_out* out);
+int snownews_filter_transform (const char* in, size_t insize, struct snownews_filter_out* out);
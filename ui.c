@@ -18,10 +18,12 @@
 #include "ui.h"
 #include "main.h"
 #include "about.h"
+#include "arena.h"
 #include "cat.h"
 #include "conv.h"
 #include "dialog.h"
 #include "feedio.h"
+#include "rxbuf.h"
 #include "setup.h"
 #include "uiutil.h"
 #include <ncurses.h>
@@ -183,7 +185,7 @@ static void UIDisplayItem (const struct newsitem* current_item, const struct fee
 	    snprintf (keyinfostr, sizeof (keyinfostr), _("Press '%c' or Enter to return to previous screen. Hit '%c' for help screen."), _settings.keybindings.prevmenu, _settings.keybindings.help);
 	UIStatus (keyinfostr, 0, 0);
 
-	int uiinput = getch();
+	int uiinput = UIGetKey (false);
 	if (uiinput == _settings.keybindings.help || uiinput == '?')
 	    UIDisplayItemHelp();
 	else if (uiinput == '\n' || uiinput == _settings.keybindings.prevmenu || uiinput == _settings.keybindings.enter) {
@@ -447,9 +449,8 @@ static int UIDisplayFeed (struct feed* current_feed)
 	UIStatus (tmpstr, 0, 0);
 
 	move (highlightline, 0);
-	int uiinput = getch();
+	int uiinput = UIGetKey (false);
 
-	time_t curtime = time (NULL);
 	if (typeahead) {
 	    // Only match real characters.
 	    if (uiinput >= ' ' && uiinput <= '~') {
@@ -532,13 +533,20 @@ static int UIDisplayFeed (struct feed* current_feed)
 		if (uiinput == _settings.keybindings.forcereload) {
 		    free (current_feed->lasterror);
 		    current_feed->lasterror = NULL;
+		    current_feed->digest = 0;
 		}
 
-		UpdateFeed (current_feed);
-		highlighted = current_feed->items;
-		// Reset first_scr_ptr if reloading.
-		first_scr_ptr = current_feed->items;
-		reloaded = true;
+		// The items shown here are kept until this view returns,
+		// then the feed list swaps in the new ones.
+		if (StartFeedUpdate (current_feed))
+		    UIStatus (_("Reloading, the new items are shown in the feed list."), 1, 0);
+		else {
+		    UpdateFeed (current_feed);
+		    highlighted = current_feed->items;
+		    // Reset first_scr_ptr if reloading.
+		    first_scr_ptr = current_feed->items;
+		    reloaded = true;
+		}
 	    } else if (uiinput == _settings.keybindings.urljump)
 		UISupportURLJump (current_feed->link);
 	    else if (uiinput == _settings.keybindings.urljump2 && highlighted)
@@ -547,12 +555,12 @@ static int UIDisplayFeed (struct feed* current_feed)
 		for (struct newsitem* i = current_feed->items; i; i = i->next) {
 		    if (!i->data->readstatus) {
 			i->data->readstatus = true;
-			current_feed->mtime = curtime;
+			current_feed->cachedirty = true;
 		    }
 		}
 	    } else if (uiinput == _settings.keybindings.markunread && highlighted) {
 		highlighted->data->readstatus = !highlighted->data->readstatus;
-		current_feed->mtime = curtime;
+		current_feed->cachedirty = true;
 		reloaded = true;
 	    } else if (uiinput == _settings.keybindings.about)
 		UIAbout();
@@ -579,7 +587,7 @@ static int UIDisplayFeed (struct feed* current_feed)
 		UIDisplayItem (highlighted, current_feed);
 		if (!highlighted->data->readstatus) {
 		    highlighted->data->readstatus = true;
-		    current_feed->mtime = curtime;
+		    current_feed->cachedirty = true;
 		}
 		tmp_highlighted = highlighted;
 		tmp_first = first_scr_ptr;
@@ -684,6 +692,12 @@ void UIMainInterface (void)
     bool andxor = false;	// Toggle for AND/OR combinations of filters.
 
     while (1) {
+	// Swap in the feeds downloaded in the background. Not while a
+	// category filter is active, since it uses copies of the feeds.
+	if (!filters[0] && FinishFeedUpdates (UIAddedFeedParsed))
+	    update_smartfeeds = true;
+	if (!filters[0] && _settings.autorefresh)
+	    StartDueFeedUpdates();
 	if (update_smartfeeds) {
 	    // This only needs to be done if new items are added, old removed.
 	    // Reload, add, delete.
@@ -858,11 +872,14 @@ void UIMainInterface (void)
 	    snprintf (msgbuf, sizeof (msgbuf), _("Press '%c' for help window."), _settings.keybindings.help);
 	    if (easterEgg())
 		snprintf (msgbuf, sizeof (msgbuf), _("Press '%c' for help window. (Press '%c' to play Santa Hunta!)"), _settings.keybindings.help, _settings.keybindings.about);
+	    unsigned nupdates = PendingFeedUpdates();
+	    if (nupdates)
+		snprintf (msgbuf, sizeof (msgbuf), _("Updating feeds, %u left... Press '%c' to cancel."), nupdates, _settings.keybindings.cancelrefresh);
 	    UIStatus (msgbuf, 0, 0);
 	}
 
 	move (highlightline, 0);
-	int uiinput = getch();
+	int uiinput = UIGetKey (!filters[0]);
 
 	if (typeahead) {
 	    // Only match real characters.
@@ -892,17 +909,29 @@ void UIMainInterface (void)
 		    if (highlighted && uiinput == _settings.keybindings.forcereload) {
 			free (highlighted->lasterror);
 			highlighted->lasterror = NULL;
+			highlighted->digest = 0;
+		    }
+		    if (highlighted && !StartFeedUpdate (highlighted)) {
+			UpdateFeed (highlighted);
+			update_smartfeeds = true;
 		    }
-		    UpdateFeed (highlighted);
-		    update_smartfeeds = true;
 		}
 	    } else if (uiinput == _settings.keybindings.reloadall) {
 		if (filters[0])
 		    UIStatus (_("Please deactivate the category filter before using this function."), 2, 0);
 		else {
-		    UpdateAllFeeds();
+		    unsigned nbackingoff = StartAllFeedsUpdate();
+		    if (nbackingoff) {
+			char msgbuf[128];
+			snprintf (msgbuf, sizeof (msgbuf), _("%u failing feeds were skipped until their retry time."), nbackingoff);
+			UIStatus (msgbuf, 1, 0);
+		    }
 		    update_smartfeeds = true;
 		}
+	    } else if (uiinput == _settings.keybindings.cancelrefresh && PendingFeedUpdates()) {
+		char msgbuf[128];
+		snprintf (msgbuf, sizeof (msgbuf), _("Refresh cancelled, %u feeds were not updated."), CancelFeedUpdates());
+		UIStatus (msgbuf, 1, 0);
 	    } else if (uiinput == _settings.keybindings.addfeed || uiinput == _settings.keybindings.newheadlines) {
 		if (filters[0])
 		    UIStatus (_("Please deactivate the category filter before using this function."), 2, 0);
@@ -962,16 +991,9 @@ void UIMainInterface (void)
 			// Unlink pointer from chain.
 			if (highlighted == _feed_list) {
 			    // first element
-			    if (_feed_list->next) {
-				_feed_list = _feed_list->next;
-				first_scr_ptr = _feed_list;
-				highlighted->next->prev = NULL;
-			    } else {
-				_feed_list = NULL;
-				first_scr_ptr = NULL;
-			    }
-			    // Set new highlighted to _feed_list again.
-			    saved_highlighted = _feed_list;
+			    first_scr_ptr = highlighted->next;
+			    // Set new highlighted to the new list head.
+			    saved_highlighted = highlighted->next;
 			} else if (highlighted->next == NULL) {
 			    // last element
 			    // Set new highlighted to element before deleted one.
@@ -979,8 +1001,6 @@ void UIMainInterface (void)
 			    // If highlighted was first line move first line upward in pointer chain.
 			    if (highlighted == first_scr_ptr)
 				first_scr_ptr = first_scr_ptr->prev;
-
-			    highlighted->prev->next = NULL;
 			} else {
 			    // element inside list */
 			    // Set new highlighted to element after deleted one.
@@ -988,36 +1008,24 @@ void UIMainInterface (void)
 			    // If highlighted was last line, move first line downward in pointer chain.
 			    if (highlighted == first_scr_ptr)
 				first_scr_ptr = first_scr_ptr->next;
-
-			    highlighted->prev->next = highlighted->next;
-			    highlighted->next->prev = highlighted->prev;
 			}
+			RemoveFeedFromList (highlighted);
 			// Put highlight to new highlight position.
 			highlighted = saved_highlighted;
 
 			// free (removed) pointer
+			CancelFeedUpdate (removed);
+			UIAddedFeedRemoved (removed);
 			if (!removed->smartfeed) {
-			    if (removed->items) {
-				while (removed->items->next) {
-				    removed->items = removed->items->next;
-				    free (removed->items->prev->data->title);
-				    free (removed->items->prev->data->link);
-				    free (removed->items->prev->data->description);
-				    free (removed->items->prev);
-				}
-				free (removed->items->data->title);
-				free (removed->items->data->link);
-				free (removed->items->data->description);
-				free (removed->items);
-			    }
+			    FreeArena (removed->itemarena);
 			    free (removed->feedurl);
-			    free (removed->xmltext);
-			    removed->xmltext = NULL;
+			    RxBufRelease (&removed->xmltext, &removed->xmlcapacity);
 			    removed->content_length = 0;
 			    free (removed->title);
 			    free (removed->link);
 			    free (removed->description);
 			    free (removed->lasterror);
+			    free (removed->etag);
 			    free (removed->custom_title);
 			    free (removed->original);
 			    free (removed);
@@ -1074,6 +1082,11 @@ void UIMainInterface (void)
 		    UIStatus (_("You cannot move items while a category filter is defined!"), 2, 0);
 		    continue;
 		}
+		// Moving swaps feed contents under the running downloads
+		if (PendingFeedUpdates()) {
+		    UIStatus (_("Please wait for the feed update to finish."), 2, 0);
+		    continue;
+		}
 		// Move item up.
 		if (highlighted) {
 		    if (highlighted->prev != NULL) {
@@ -1091,6 +1104,10 @@ void UIMainInterface (void)
 		    UIStatus (_("You cannot move items while a category filter is defined!"), 2, 0);
 		    continue;
 		}
+		if (PendingFeedUpdates()) {
+		    UIStatus (_("Please wait for the feed update to finish."), 2, 0);
+		    continue;
+		}
 		// Move item down.
 		if (highlighted) {
 		    if (highlighted->next) {
@@ -1111,12 +1128,11 @@ void UIMainInterface (void)
 		// This function is safe for using in filter mode, because it only
 		// changes int values. It automatically marks the correct ones read
 		// if a filter is applied since we are using a copy of the main data.
-		time_t curtime = time (NULL);
 		for (struct feed* f = _feed_list; f; f = f->next) {
 		    for (struct newsitem* i = f->items; i; i = i->next) {
 			if (!i->data->readstatus) {
 			    i->data->readstatus = true;
-			    f->mtime = curtime;
+			    f->cachedirty = true;
 			}
 		    }
 		}
@@ -1140,6 +1156,8 @@ void UIMainInterface (void)
 	    } else if (uiinput == _settings.keybindings.sortfeeds && highlighted) {
 		if (filters[0])	// Deactivate sorting function if filter is applied.
 		    UIStatus (_("Please deactivate the category filter before using this function."), 2, 0);
+		else if (PendingFeedUpdates())
+		    UIStatus (_("Please wait for the feed update to finish."), 2, 0);
 		else {
 		    SnowSort();
 		    _feed_list_changed = true;
@@ -16,6 +16,9 @@
 // along with Snownews. If not, see http://www.gnu.org/licenses/.
 
 #include "uiutil.h"
+#include "feedio.h"
+#include "netio.h"
+#include "filters.h"
 #include <ncurses.h>
 
 //----------------------------------------------------------------------
@@ -42,9 +45,47 @@ void InitCurses (void)
     curs_set (_settings.cursor_always_visible);
 }
 
+// Reads a key like getch, running background feed updates while waiting.
+// With stopforupdates, returns ERR when downloaded feeds are ready to be
+// parsed, so the caller can redraw with the new items, and with automatic
+// refresh enabled, when feeds are due to be refreshed.
+int UIGetKey (bool stopforupdates)
+{
+    // With automatic refresh, also wake up when a feed is due
+    bool waitfordue = stopforupdates && _settings.autorefresh;
+    while (PendingDownloads() || PendingExecFeeds() || waitfordue) {
+	if (stopforupdates && FeedUpdatesReady())
+	    return ERR;
+	unsigned wait = 1000;
+	if (waitfordue) {
+	    time_t now = time (NULL), due = NextFeedRefresh();
+	    if (due && due <= now)
+		return ERR;
+	    if (!PendingDownloads() && !PendingExecFeeds())
+		wait = due && due - now < 60 ? (due - now) * 1000 : 60000;
+	}
+	// Keys may already be buffered by curses
+	timeout (0);
+	int key = getch();
+	timeout (-1);
+	if (key != ERR)
+	    return key;
+	RunFeedUpdates (STDIN_FILENO, wait);
+    }
+    if (stopforupdates && FeedUpdatesReady())
+	return ERR;
+    return getch();
+}
+
 // Print text in statusbar.
 void UIStatus (const char* text, int delay, int warning)
 {
+    // Without the UI, only warnings are shown, on stderr
+    if (_settings.headless) {
+	if (warning)
+	    fprintf (stderr, SNOWNEWS_NAME ": %s\n", text);
+	return;
+    }
     int attr = WA_REVERSE;
     if (warning)
 	attr |= COLOR_PAIR (10);
@@ -193,6 +234,7 @@ static void SmartFeedNewitems (struct feed* smart_feed)
 	free (smart_feed->items);
 	smart_feed->items = NULL;
     }
+    struct newsitem* last_item = NULL;
     for (struct feed* f = _feed_list; f; f = f->next) {
 	// Do not add the smart feed recursively. 8)
 	if (f == smart_feed)
@@ -205,14 +247,13 @@ static void SmartFeedNewitems (struct feed* smart_feed)
 	    new_item->data = item->data;
 
 	    // Add to data structure.
-	    if (!smart_feed->items)
+	    if (!last_item)
 		smart_feed->items = new_item;
 	    else {
-		new_item->prev = smart_feed->items;
-		while (new_item->prev->next)
-		    new_item->prev = new_item->prev->next;
-		new_item->prev->next = new_item;
+		new_item->prev = last_item;
+		last_item->next = new_item;
 	    }
+	    last_item = new_item;
 	}
     }
     // Only fill out once.
@@ -234,6 +275,8 @@ bool SmartFeedExists (const char* smartfeed)
 
 void DrawProgressBar (unsigned numobjects, unsigned titlestrlen)
 {
+    if (_settings.headless)
+	return;
     attron (WA_REVERSE);
     mvhline (LINES - 1, titlestrlen + 1, '=', numobjects);
     mvaddch (LINES - 1, COLS - 3, ']');
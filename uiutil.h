@@ -19,6 +19,7 @@
 #include "main.h"
 
 void InitCurses (void);
+int UIGetKey (bool stopforupdates);
 void UIStatus (const char* text, int delay, int warning);
 void SwapPointers (struct feed* one, struct feed* two);
 void SnowSort (void);